@@ -0,0 +1,213 @@
+/*
+   * @file   audio.c
+   * @brief  Sound timer output through SDL audio
+   *
+   * Edges are timestamped on a sample clock derived from
+   * SDL_GetTicks(). The callback renders the window one device
+   * buffer behind "now", so an edge pushed by the emulator lands
+   * on the exact sample it was raised on as long as it arrives
+   * within one buffer. Bigger buffers mean more latency but fewer
+   * late edges when the emulator is held up.
+   *
+   * Nothing in the callback locks or allocates.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <SDL.h>
+
+#include "audio.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static unsigned int RoundPow2(unsigned int n)
+{
+   unsigned int p = 1;
+
+   while (p < n)
+   {
+      p = p << 1;
+   }
+
+   return p;
+}
+
+static Uint32 SampleClock(Audio * audio)
+{
+   return (Uint32) ((Uint64) (SDL_GetTicks() - audio->base) * AUDIO_RATE / 1000);
+}
+
+/* Sum the odd harmonics below Nyquist so the square wave does not alias */
+static void BuildTable(Audio * audio)
+{
+   double wave[AUDIO_TABLE];
+   double peak = 0;
+   int i, k;
+
+   for (i = 0; i < AUDIO_TABLE; i++)
+   {
+      wave[i] = 0;
+      for (k = 1; k * AUDIO_TONE < AUDIO_RATE / 2; k += 2)
+      {
+         wave[i] += sin(2 * M_PI * k * i / AUDIO_TABLE) / k;
+      }
+
+      if (fabs(wave[i]) > peak) peak = fabs(wave[i]);
+   }
+
+   for (i = 0; i < AUDIO_TABLE; i++)
+   {
+      audio->table[i] = (Sint16) (wave[i] / peak * AUDIO_VOLUME);
+   }
+}
+
+static void AudioCallback(void * userdata, Uint8 * stream, int len)
+{
+   Audio *audio = userdata;
+   Sint16 *out = (Sint16 *) stream;
+   AudioEdge *edge;
+   Uint32 head;
+   Uint32 target;
+   Sint32 offset;
+   int n = len / 2;
+   int i, end;
+
+   /* Keep the clock one buffer behind the emulator, resyncing on drift */
+   target = SampleClock(audio) - audio->buffer;
+   offset = (Sint32) (target - audio->clock);
+   if (!audio->synced || offset > (Sint32) audio->buffer || offset < -(Sint32) audio->buffer)
+   {
+      audio->clock = target;
+      audio->synced = 1;
+   }
+
+   head = __atomic_load_n(&audio->head, __ATOMIC_ACQUIRE);
+
+   for (i = 0; i < n; i = end)
+   {
+      end = n;
+      edge = NULL;
+
+      if (audio->tail != head)
+      {
+         edge = &audio->ring[audio->tail & (audio->depth - 1)];
+         offset = (Sint32) (edge->time - audio->clock);
+         if (offset < 0) audio->late++;
+         if (offset < i) offset = i;
+         if (offset < n)
+         {
+            end = offset;
+         } else {
+            edge = NULL;
+         }
+      }
+
+      if (audio->on)
+      {
+         for (; i < end; i++)
+         {
+            out[i] = audio->table[(audio->phase >> 16) & (AUDIO_TABLE - 1)];
+            audio->phase += audio->step;
+         }
+      } else {
+         for (; i < end; i++)
+         {
+            out[i] = 0;
+         }
+      }
+
+      if (edge != NULL)
+      {
+         /* Start every beep on a zero crossing */
+         if (edge->on && !audio->on) audio->phase = 0;
+         audio->on = edge->on;
+         __atomic_store_n(&audio->tail, audio->tail + 1, __ATOMIC_RELEASE);
+      }
+   }
+
+   audio->clock += n;
+}
+
+int InitAudio(Audio * audio, unsigned int depth, unsigned int buffer)
+{
+   SDL_AudioSpec spec;
+
+   audio->enabled = 0;
+   audio->depth = RoundPow2(depth > 0 ? depth : AUDIO_RING);
+   audio->buffer = RoundPow2(buffer > 0 ? buffer : AUDIO_BUFFER);
+   audio->head = 0;
+   audio->tail = 0;
+   audio->synced = 0;
+   audio->clock = 0;
+   audio->phase = 0;
+   audio->step = (Uint32) ((Uint64) AUDIO_TONE * AUDIO_TABLE * 65536 / AUDIO_RATE);
+   audio->on = 0;
+   audio->last = 0;
+   audio->dropped = 0;
+   audio->late = 0;
+
+   if ((audio->ring = malloc(audio->depth * sizeof(AudioEdge))) == NULL) return 1;
+
+   BuildTable(audio);
+
+   if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) return 1;
+
+   spec.freq = AUDIO_RATE;
+   spec.format = AUDIO_S16SYS;
+   spec.channels = 1;
+   spec.samples = audio->buffer;
+   spec.callback = AudioCallback;
+   spec.userdata = audio;
+
+   /* No obtained spec, so SDL converts to our format if it must */
+   if (SDL_OpenAudio(&spec, NULL) < 0)
+   {
+      SDL_QuitSubSystem(SDL_INIT_AUDIO);
+      return 1;
+   }
+
+   audio->base = SDL_GetTicks();
+   audio->enabled = 1;
+   SDL_PauseAudio(0);
+
+   return 0;
+}
+
+/* Called by the emulator whenever the sound timer may have changed */
+void PushAudioEdge(Audio * audio, int on)
+{
+   unsigned int tail;
+   AudioEdge *edge;
+
+   on = on ? 1 : 0;
+   if (!audio->enabled || on == audio->last) return;
+
+   tail = __atomic_load_n(&audio->tail, __ATOMIC_ACQUIRE);
+   if (audio->head - tail >= audio->depth)
+   {
+      /* Leave last alone so the edge is retried on the next push */
+      audio->dropped++;
+      return;
+   }
+
+   edge = &audio->ring[audio->head & (audio->depth - 1)];
+   edge->time = SampleClock(audio);
+   edge->on = on;
+   __atomic_store_n(&audio->head, audio->head + 1, __ATOMIC_RELEASE);
+   audio->last = on;
+}
+
+void QuitAudio(Audio * audio)
+{
+   if (audio->enabled)
+   {
+      SDL_CloseAudio();
+      SDL_QuitSubSystem(SDL_INIT_AUDIO);
+      audio->enabled = 0;
+   }
+
+   free(audio->ring);
+   audio->ring = NULL;
+}
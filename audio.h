@@ -0,0 +1,51 @@
+/*
+   * @file   audio.h
+   * @brief  Sound timer output through SDL audio
+   *
+   * The emulator pushes sound timer on/off edges into a
+   * single producer, single consumer ring. The SDL audio
+   * callback pops them and plays a square wave between them.
+*/
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <SDL.h>
+
+#define AUDIO_RATE 44100
+#define AUDIO_TONE 440 /* Beep pitch in Hz */
+#define AUDIO_VOLUME 6000 /* Peak sample value */
+#define AUDIO_TABLE 256 /* Samples in one period of the wave table, power of two */
+#define AUDIO_RING 64 /* Default edge ring depth, power of two */
+#define AUDIO_BUFFER 1024 /* Default device buffer in samples, power of two */
+#define AUDIO_RING_MAX 65536 /* Largest --audio-ring */
+#define AUDIO_BUFFER_MAX 32768 /* Largest --audio-buffer, SDL counts samples in 16 bits */
+
+typedef struct {
+   Uint32 time; /* Sample clock time of the edge */
+   Uint32 on; /* 1 = tone starts, 0 = tone stops */
+} AudioEdge;
+
+typedef struct {
+   AudioEdge *ring; /* Edge ring, depth entries */
+   unsigned int depth; /* Ring depth, power of two */
+   unsigned int head; /* Next slot to write, only written by the emulator */
+   unsigned int tail; /* Next slot to read, only written by the callback */
+   unsigned int buffer; /* Device buffer in samples, also the scheduling delay */
+   Uint32 base; /* SDL_GetTicks() when the sample clock started */
+   Uint32 clock; /* Sample clock time of the next sample the callback writes */
+   int synced; /* Has the callback aligned its clock yet? */
+   Sint16 table[AUDIO_TABLE]; /* One period of a band-limited square wave */
+   Uint32 phase; /* 16.16 fixed point position in table */
+   Uint32 step; /* 16.16 fixed point phase increment per sample */
+   int on; /* Tone playing? Callback side */
+   int last; /* Last state pushed. Emulator side */
+   int enabled; /* Did the device open? */
+   unsigned int dropped; /* Edges lost to a full ring */
+   unsigned int late; /* Edges that arrived after their time was played */
+} Audio;
+
+int InitAudio(Audio * audio, unsigned int depth, unsigned int buffer);
+void PushAudioEdge(Audio * audio, int on);
+void QuitAudio(Audio * audio);
+
+#endif
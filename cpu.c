@@ -0,0 +1,1019 @@
+/*
+   * @file   cpu.c
+   * @brief  chip-8 CPU core: fetch, decode, execute
+   *
+   * Based on chip-8, written for learning experience
+   * and computing project.
+   * @author Aidan Marlin     
+   * @date   October 2012
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cpu.h"
+
+unsigned char chip8_fontset[80] =
+{ 
+   0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+   0x20, 0x60, 0x20, 0x20, 0x70, // 1
+   0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+   0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+   0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+   0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+   0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+   0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+   0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+   0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+   0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+   0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+   0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+   0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+   0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+   0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+/* SUPER-CHIP 8x10 digits for FX30 */
+unsigned char chip8_bigfont[160] =
+{
+   0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+   0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+   0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+   0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+   0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+   0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+   0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+   0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+   0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+   0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+   0x3C, 0x7E, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, // A
+   0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC, // B
+   0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C, // C
+   0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+   0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+   0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+int exiterror(int err)
+{
+   switch(err)
+   {
+      case 2:
+         printf("Error 1: Cannot open file\n");
+         exit(2);
+      break;
+
+      case 3:
+         printf("Error 3: Error reading from file\n");
+         exit(3);
+      break;
+
+      case 4:
+         printf("Specify rom file\n");
+         printf("Error 4: Incorrect number of arguments\n");
+         exit(4);
+      break;
+
+      case 5:
+         printf("Error 5: Unknown quirk profile\n");
+         exit(5);
+      break;
+
+      case 6:
+         printf("Error 6: ROM too large, %d bytes at most\n", ROM_MAX);
+         exit(6);
+      break;
+
+      case 7:
+         printf("Error 7: ROM not found in pack\n");
+         exit(7);
+      break;
+
+      case 20:
+         printf("Error 20: Missing opcode\n");
+         exit(20);
+      break;
+
+      case 21:
+         printf("Error 21: Stack overflow\n");
+         exit(21);
+      break;
+
+      case 22:
+         printf("Error 22: Stack underflow\n");
+         exit(22);
+      break;
+
+      case 23:
+         printf("Program exited\n");
+         exit(0);
+      break;
+
+      case 30:
+         printf("Error 30: Could not initialise screen\n");
+         exit(30);
+      break;
+
+      case 31:
+         printf("Error 31: Could not start emulation thread\n");
+         exit(31);
+      break;
+
+      case 40:
+         printf("Error 40: Could not draw to screen\n");
+         exit(40);
+      break;
+
+      default:
+         printf("Error: Unknown error code\n");
+         exit(1);
+      break;
+   }
+}
+int DecrementTimers(Chip8 * chip8)
+{
+   if(chip8->delay_timer > 0)
+   {
+      chip8->delay_timer=chip8->delay_timer - 1;
+   }
+
+   if(chip8->sound_timer > 0)
+   {
+      chip8->sound_timer=chip8->sound_timer - 1;
+   }
+
+   return 0;
+}
+int DebugOutput(Chip8 *chip8)
+{
+   int i;
+
+   printf("------------------\n");
+
+   printf("pc = %x\n",chip8->pc);
+   printf("I = %x\n",chip8->I);
+
+   for(i=0;i<=0xF;i++)
+   {
+      printf("V[%x] = %x\n",i,chip8->V[i]);
+   }
+
+   printf("------------------\n");
+
+   return 0;
+}
+
+int InitCPU(Chip8 *chip8)
+{
+   int i;
+
+   chip8->pc = 0x200;
+   chip8->opcode = 0;
+   chip8->I = 0;
+   chip8->sp = 0;
+
+   /* Clear registers V0-VF */
+   for(i=0;i<16;i++)
+   {
+      chip8->V[i] = 0;
+   }
+
+   /* Clear display, back to low resolution */
+   memset(chip8->gfx, 0, sizeof(chip8->gfx));
+   chip8->hires = 0;
+
+   /* Clear RPL flags */
+   for(i=0;i<8;i++)
+   {
+      chip8->rpl[i] = 0;
+   }
+
+   /* Clear stack */
+   for(i=0;i<16;i++)
+   {
+      chip8->stack[i] = 0;
+   }
+
+   /* Clear memory */
+   for(i=0;i<4096;i++)
+   {
+      chip8->memory[i] = 0;
+   }
+
+   /* Clear keypad */
+   for(i=0;i<16;i++)
+   {
+      chip8->key[i] = 0;
+   }
+
+   /* Load fontset */
+   for(i=0;i<80;i++)
+   {
+      chip8->memory[i] = chip8_fontset[i];
+   }
+
+   for(i=0;i<160;i++)
+   {
+      chip8->memory[BIGFONT + i] = chip8_bigfont[i];
+   }
+
+   /* Reset delay and sound timers */
+   chip8->delay_timer = 0;
+   chip8->sound_timer = 0;
+
+   chip8->DrawFlag = 0;
+   chip8->profile = PROFILE_DEFAULT;
+
+   return 0;
+}
+
+/*
+   Reads a ROM file to 0x200. Returns 0, or the exiterror code:
+   2 if it can't be opened, 3 if unreadable or empty, 6 if it
+   won't fit in memory
+*/
+int LoadFile(const char * path, Chip8 * chip8)
+{
+   unsigned char buf[512];
+   ssize_t n;
+   int size = 0;
+   int fd;
+
+   if ((fd = open(path, O_RDONLY)) == -1) return 2;
+
+   while ((n = read(fd, buf, sizeof(buf))) > 0)
+   {
+      if (size + n > ROM_MAX)
+      {
+         close(fd);
+         return 6;
+      }
+      memcpy(&chip8->memory[ROM_START + size], buf, n);
+      size += n;
+   }
+
+   close(fd);
+   if (n == -1 || size == 0) return 3;
+
+   return 0;
+}
+
+/* Pixel at a time access to the packed screen. engine.c works a word at a time */
+static int GetPixel(Chip8 * chip8, int x, int y)
+{
+   return (chip8->gfx[y][x >> 6] >> (63 - (x & 63))) & 1;
+}
+
+static void SetPixel(Chip8 * chip8, int x, int y, int on)
+{
+   uint64_t bit = 1ULL << (63 - (x & 63));
+
+   if (on)
+   {
+      chip8->gfx[y][x >> 6] |= bit;
+   } else {
+      chip8->gfx[y][x >> 6] &= ~bit;
+   }
+}
+
+int EmulateCycle(Chip8 * chip8)
+{
+   const Quirks *quirks = &quirk_profiles[chip8->profile];
+   int opfound = 0;
+   int debug = 0;
+   int i, x, y, tmp;
+
+   unsigned short xcoord = 0;
+   unsigned short ycoord = 0;
+   unsigned short height = 0;
+   unsigned short width = 0;
+   unsigned short pixel;
+
+   /* Fetch */
+   chip8->opcode = chip8->memory[chip8->pc & 0xFFF] << 8 | chip8->memory[(chip8->pc+1) & 0xFFF];
+
+   if (debug == 1) printf("%x\n",chip8->opcode);
+
+   switch(chip8->opcode & 0xF000)
+   {
+      case 0x1000:
+         chip8->pc=chip8->opcode & 0x0FFF;
+
+         if (debug == 1) printf("pc = %x\n",chip8->opcode & 0x0FFF);
+         opfound = 1;
+      break;
+
+      case 0xA000: /* Checked */
+         chip8->I = chip8->opcode & 0x0FFF;
+
+         if (debug == 1) printf("I = %x\n", chip8->opcode & 0x0FFF);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0x4000:
+         if (chip8->V[(chip8->opcode & 0x0F00) >> 8] != (chip8->opcode & 0x00FF))
+         {
+            chip8->pc = chip8->pc + 4;
+         } else {
+            chip8->pc = chip8->pc + 2;
+         }
+
+         if (debug == 1) printf("pc = %x\n",chip8->pc);
+         opfound = 1;
+      break;
+
+      /* 4XNN - Skips the next instruction if VX doesn't equal NN. */
+
+      case 0x5000:
+         if ((chip8->opcode & 0x000F) != 0) return ERR_OPCODE;
+         if (chip8->V[(chip8->opcode & 0x0F00) >> 8] == chip8->V[(chip8->opcode & 0x00F0) >> 4])
+         {
+            chip8->pc = chip8->pc + 4;
+         } else {
+            chip8->pc = chip8->pc + 2;
+         }
+         opfound = 1;
+      break;
+
+      /* 5XY0 - Skips the next instruction if VX equals VY. */
+
+      case 0xB000:
+         if (quirks->jump_vx)
+         {
+            chip8->pc = (chip8->opcode & 0x0FFF) + chip8->V[(chip8->opcode & 0x0F00) >> 8];
+         } else {
+            chip8->pc = (chip8->opcode & 0x0FFF) + chip8->V[0];
+         }
+         opfound = 1;
+      break;
+
+      /* BNNN - Jumps to NNN plus V0. BXNN on CHIP-48 and SUPER-CHIP, XNN plus VX */
+
+      case 0xC000:
+         /* 5 should be a random number */
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = 9 & (chip8->opcode & 0x00FF);
+
+         if (debug == 1) printf("V[%x] = %x",(chip8->opcode & 0x0F00) >> 8,9 & (chip8->opcode & 0x00FF));
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* Cxkk - RND Vx, byte
+      Set Vx = random byte AND kk.
+
+      The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND. */
+
+      case 0x6000: /* Checked */
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->opcode & 0x00FF;
+
+         if (debug == 1) printf("V[%x] = %x\n", (chip8->opcode & 0x0F00) >> 8, chip8->opcode & 0x00FF);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0xD000:
+         height = chip8->opcode & 0x000F;
+         width = 8;
+
+         /* DXY0 - SUPER-CHIP 16x16 sprite, two bytes per row */
+         if (height == 0)
+         {
+            height = 16;
+            width = 16;
+         }
+
+         /* Start position wraps, the rest of the sprite clips at the edges */
+         xcoord = chip8->V[(chip8->opcode & 0x0F00) >> 8] % SCREEN_WIDTH(chip8);
+         ycoord = chip8->V[(chip8->opcode & 0x00F0) >> 4] % SCREEN_HEIGHT(chip8);
+         chip8->V[0xF] = 0;
+
+         for (i=0;i<height && ycoord+i<SCREEN_HEIGHT(chip8);i++)
+         {
+            if (width == 16)
+            {
+               pixel = chip8->memory[(chip8->I + 2*i) & 0xFFF] << 8 | chip8->memory[(chip8->I + 2*i + 1) & 0xFFF];
+            } else {
+               pixel = chip8->memory[(chip8->I + i) & 0xFFF];
+            }
+            //printf("sprite %x\n",pixel);
+            for (x=0;x<width && xcoord+x<SCREEN_WIDTH(chip8);x++)
+            {
+               if ((pixel & ((1 << (width - 1)) >> x)) != 0)
+               {
+                  //printf("x %d y %d px %x\n",xcoord,ycoord,pixel);
+                  if (GetPixel(chip8,xcoord+x,ycoord+i) == 1) chip8->V[0xF] = 1;
+                  SetPixel(chip8,xcoord+x,ycoord+i,!GetPixel(chip8,xcoord+x,ycoord+i));
+                }
+            }
+         }
+
+         chip8->DrawFlag = 1;
+
+         if (debug == 1) printf("Draw call %x\n",chip8->opcode);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0x2000: /* Checked */
+         if (chip8->sp >= 16) return ERR_STACK_OVERFLOW;
+         chip8->stack[chip8->sp] = chip8->pc;
+         chip8->sp++;
+         chip8->pc = chip8->opcode & 0x0FFF;
+
+         if (debug == 1) printf("pc = %x\n", chip8->opcode & 0x0FFF);
+         opfound = 1;
+      break;
+
+      case 0x3000:
+         if (chip8->V[(chip8->opcode & 0x0F00) >> 8] == (chip8->opcode & 0x00FF))
+         {
+            chip8->pc = chip8->pc + 4;
+         } else {
+            chip8->pc = chip8->pc + 2;
+         }
+
+         if (debug == 1) printf("V[%x] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x0F00) >> 8]);
+         opfound = 1;
+      break;
+
+      /* 3XNN - Skips the next instruction if VX equals NN. */
+
+      case 0x7000: /* Checked */
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->V[(chip8->opcode & 0x0F00) >> 8] + (chip8->opcode & 0x00FF);
+
+         if (debug == 1) printf("V[%x] = %x\n", (chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x00FF) >> 8] + (chip8->opcode & 0x00FF));
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+   }
+
+   if (opfound == 1) return 0;
+
+   switch(chip8->opcode & 0xF0FF)
+   {
+      case 0xF00A:
+         /* pc stays put until a key is down, so the wait spans frames */
+         for(i=0;i<16;i++)
+         {
+            if (chip8->key[i] != 0)
+            {
+               chip8->V[(chip8->opcode & 0x0F00) >> 8] = i;
+               chip8->pc = chip8->pc + 2;
+               break;
+            }
+         }
+         opfound = 1;
+      break;
+
+      /* FX0A - A key press is awaited, and then stored in VX. */
+
+      case 0xF01E:
+         chip8->I = chip8->I + chip8->V[(chip8->opcode & 0x0F00) >> 8];
+
+         if (debug == 1) printf("I = %x\n",chip8->I);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* Fx1E - ADD I, Vx
+      Set I = I + Vx.
+
+      The values of I and Vx are added, and the results are stored in I. */
+
+      case 0xF018:
+         chip8->sound_timer = chip8->V[(chip8->opcode & 0x0F00) >> 8];
+
+         if (debug == 1) printf("sound_timer = %x\n",chip8->V[(chip8->opcode & 0x0F00) >> 8]);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* FX18 - Sets the sound timer to VX. */
+
+      case 0xF033:
+         chip8->memory[chip8->I & 0xFFF] = chip8->V[(chip8->opcode & 0x0F00) >> 8] / 100;
+         chip8->memory[(chip8->I + 1) & 0xFFF] = (chip8->V[(chip8->opcode & 0x0F00) >> 8] / 10) % 10;
+         chip8->memory[(chip8->I + 2) & 0xFFF] = (chip8->V[(chip8->opcode & 0x0F00) >> 8] / 1) % 10;
+
+         if (debug == 1)
+         {
+            printf("Mem[%x] = %x\n",chip8->I, chip8->V[(chip8->opcode & 0x0F00) >> 8] / 100);
+            printf("Mem[%x] = %x\n",chip8->I + 1, (chip8->V[(chip8->opcode & 0x0F00) >> 8] / 10) % 10);
+            printf("Mem[%x] = %x\n",chip8->I + 2, (chip8->V[(chip8->opcode & 0x0F00) >> 8] / 10) % 1);
+            printf("I,I+1,I+2 = %d%d%d\n",chip8->memory[chip8->I & 0xFFF],chip8->memory[(chip8->I+1) & 0xFFF],chip8->memory[(chip8->I+2) & 0xFFF]);
+         }
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0xE09E:
+         if (chip8->key[chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0xF] != 0)
+         {
+            chip8->pc = chip8->pc + 4;
+         } else {
+            chip8->pc = chip8->pc + 2;
+         }
+
+         if (debug == 1) printf("pc = %x\n",chip8->pc);
+         opfound = 1;
+      break;
+
+      /* Ex9E - SKP Vx
+      Skip next instruction if key with the value of Vx is pressed.
+
+      Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2. */
+
+      case 0xE0A1:
+         if (chip8->key[chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0xF] != 1)
+         {
+            chip8->pc = chip8->pc + 4;
+         } else {
+            chip8->pc = chip8->pc + 2;
+         }
+
+         if (debug == 1) printf("key[%x] = %x\n",chip8->V[(chip8->opcode & 0x0F00) >> 8],chip8->key[chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0xF]);
+         opfound = 1;
+      break;
+
+      /* ExA1 - SKNP Vx
+      Skip next instruction if key with the value of Vx is not pressed.
+
+      Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2. */
+
+      case 0xF007:
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->delay_timer;
+
+         if (debug == 1) printf("V[%x] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->delay_timer);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* FX07 - Sets VX to the value of the delay timer. */
+
+      case 0xF015:
+         chip8->delay_timer = chip8->V[(chip8->opcode & 0x0F00) >> 8];
+
+         if (debug == 1) printf("delay_timer = %x\n",chip8->V[(chip8->opcode & 0x0F00) >> 8]);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* FX15 - Sets the delay timer to VX. */
+
+      case 0xF065:
+         for(i=0;i<=((chip8->opcode & 0x0F00) >> 8);i++)
+         {
+            chip8->V[i] = chip8->memory[(chip8->I + i) & 0xFFF];
+
+            if (debug == 1) printf("V[%x] is %x\n",i,chip8->memory[(chip8->I + i) & 0xFFF]);
+         }
+         if (quirks->index_step >= 0) chip8->I = chip8->I + ((chip8->opcode & 0x0F00) >> 8) + quirks->index_step;
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0xF029:
+         /* chip8->I = chip8->memory[chip8->V[(chip8->opcode & 0x0F00) >> 8]*5]; -- The great bug */
+         chip8->I = chip8->V[(chip8->opcode & 0x0F00) >> 8]*5;
+
+         if (debug == 1) printf("I is %x\n",chip8->I);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* FX29 - Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font. */
+
+      case 0xF055:
+         for(i=0;i<=((chip8->opcode & 0x0F00) >> 8);i++)
+         {
+            chip8->memory[(chip8->I+i) & 0xFFF] = chip8->V[i];
+
+            if (debug == 1) printf("V[%x] = %x\n",i,chip8->I+i);
+         }
+         if (quirks->index_step >= 0) chip8->I = chip8->I + ((chip8->opcode & 0x0F00) >> 8) + quirks->index_step;
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+            
+      /* FX55 - Stores V0 to VX in memory starting at address I.[4] */
+
+      case 0xF030:
+         chip8->I = BIGFONT + (chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0xF) * 10;
+
+         if (debug == 1) printf("I is %x\n",chip8->I);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* FX30 - Sets I to the 8x10 SUPER-CHIP font character for VX. */
+
+      case 0xF075:
+         for(i=0;i<=((chip8->opcode & 0x0700) >> 8);i++)
+         {
+            chip8->rpl[i] = chip8->V[i];
+         }
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0xF085:
+         for(i=0;i<=((chip8->opcode & 0x0700) >> 8);i++)
+         {
+            chip8->V[i] = chip8->rpl[i];
+         }
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* FX75 / FX85 - Store / load V0 to VX (X < 8) in the RPL user flags. */
+   }
+
+   if (opfound == 1) return 0;
+
+   /* 00CN - Scroll the screen down N pixels */
+   if ((chip8->opcode & 0xFFF0) == 0x00C0)
+   {
+      height = chip8->opcode & 0x000F;
+      for (y=SCREEN_HEIGHT(chip8)-1;y>=0;y--)
+      {
+         for (x=0;x<SCREEN_WIDTH(chip8);x++)
+         {
+            SetPixel(chip8,x,y,y >= height ? GetPixel(chip8,x,y-height) : 0);
+         }
+      }
+      chip8->DrawFlag = 1;
+      chip8->pc = chip8->pc + 2;
+      return 0;
+   }
+
+   switch(chip8->opcode)
+   {
+      case 0x00FB: /* Scroll right 4 pixels */
+         for (y=0;y<SCREEN_HEIGHT(chip8);y++)
+         {
+            for (x=SCREEN_WIDTH(chip8)-1;x>=0;x--)
+            {
+               SetPixel(chip8,x,y,x >= 4 ? GetPixel(chip8,x-4,y) : 0);
+            }
+         }
+         chip8->DrawFlag = 1;
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0x00FC: /* Scroll left 4 pixels */
+         for (y=0;y<SCREEN_HEIGHT(chip8);y++)
+         {
+            for (x=0;x<SCREEN_WIDTH(chip8);x++)
+            {
+               SetPixel(chip8,x,y,x+4 < SCREEN_WIDTH(chip8) ? GetPixel(chip8,x+4,y) : 0);
+            }
+         }
+         chip8->DrawFlag = 1;
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0x00FD: /* Exit */
+         return ERR_EXIT;
+
+      case 0x00FE: /* Low resolution, clears the screen */
+      case 0x00FF: /* High resolution, clears the screen */
+         chip8->hires = chip8->opcode & 1;
+         memset(chip8->gfx, 0, sizeof(chip8->gfx));
+         chip8->DrawFlag = 1;
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0x00E0:
+         memset(chip8->gfx, 0, sizeof(chip8->gfx));
+         chip8->DrawFlag = 1;
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      case 0x00EE:
+         if (chip8->sp == 0) return ERR_STACK_UNDERFLOW;
+         chip8->sp=chip8->sp - 1;
+         chip8->pc = chip8->stack[chip8->sp];
+
+         if (debug == 1) printf("pc = %x\n", chip8->opcode & 0x0FFF);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+   }
+
+   if (opfound == 1) return 0;
+
+   switch(chip8->opcode & 0xF00F)
+   {
+      case 0x8000: /* 0x8XY0 */
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->V[(chip8->opcode & 0x00F0) >> 4];
+
+         if (debug == 1) printf("V[%x] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x0F00) >> 8]);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8XY0 - Sets VX to the value of VY. */
+
+      case 0x8001:
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->V[(chip8->opcode & 0x0F00) >> 8] | chip8->V[(chip8->opcode & 0x00F0) >> 4];
+         if (quirks->vf_reset) chip8->V[0xF] = 0;
+
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8XY1 - Sets VX to VX or VY. The VIP clears VF on all three logic ops */
+
+      case 0x8002:
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->V[(chip8->opcode & 0x0F00) >> 8] & chip8->V[(chip8->opcode & 0x00F0) >> 4];
+         if (quirks->vf_reset) chip8->V[0xF] = 0;
+
+         if (debug == 1) printf("V[%x] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x0F00) >> 8]);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+ 
+      /* 8XY2 - Sets VX to VX and VY. */
+
+      case 0x8003:
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->V[(chip8->opcode & 0x0F00) >> 8] ^ chip8->V[(chip8->opcode & 0x00F0) >> 4];
+         if (quirks->vf_reset) chip8->V[0xF] = 0;
+
+         if (debug == 1) printf("V[%x] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x0F00) >> 8]);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8xy3 - XOR Vx, Vy
+      Set Vx = Vx XOR Vy.
+
+      Performs a bitwise exclusive OR on the values of Vx and Vy, then stores the result in Vx. An exclusive OR compares the corrseponding bits from two values, and if the bits are not both the same, then the corresponding bit in the result is set to 1. Otherwise, it is 0. */
+
+      case 0x8004:
+         tmp = chip8->V[(chip8->opcode & 0x0F00) >> 8] + chip8->V[(chip8->opcode & 0x00F0) >> 4];
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = tmp;
+
+         if (tmp > 255)
+         {
+            chip8->V[0xF] = 1;
+         } else {
+            chip8->V[0xF] = 0;
+         }
+
+         if (debug == 1) printf("V[%x] = %x. V[F] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x0F00) >> 8],chip8->V[0xF]);
+
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8xy4 - ADD Vx, Vy
+      Set Vx = Vx + Vy, set VF = carry.
+
+      The values of Vx and Vy are added together. If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx. */
+
+      /* 8XY4    Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't. */
+
+      case 0x8005:
+         /* Flags are written last, so VF as VX ends up holding the flag */
+         tmp = chip8->V[(chip8->opcode & 0x0F00) >> 8] >= chip8->V[(chip8->opcode & 0x00F0) >> 4];
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->V[(chip8->opcode & 0x0F00) >> 8] - chip8->V[(chip8->opcode & 0x00F0) >> 4];
+         chip8->V[0xF] = tmp;
+
+         if (debug == 1) printf("V[%x] = %x. V[0xF] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x0F00) >> 8],chip8->V[0xF]);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8xy5 - SUB Vx, Vy
+      Set Vx = Vx - Vy, set VF = NOT borrow.
+
+      If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx. */
+
+      /* 8XY5    VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't. */
+
+      case 0x8006:
+         tmp = quirks->shift_vy ? chip8->V[(chip8->opcode & 0x00F0) >> 4] : chip8->V[(chip8->opcode & 0x0F00) >> 8];
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = tmp >> 1;
+         chip8->V[0xF] = tmp & 1;
+
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8XY6 - Shifts VX right by one, VF gets the bit shifted out. The VIP shifts VY into VX */
+
+      case 0x8007:
+         tmp = chip8->V[(chip8->opcode & 0x00F0) >> 4] >= chip8->V[(chip8->opcode & 0x0F00) >> 8];
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->V[(chip8->opcode & 0x00F0) >> 4] - chip8->V[(chip8->opcode & 0x0F00) >> 8];
+         chip8->V[0xF] = tmp;
+
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8XY7 - Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't. */
+
+      case 0x800E:
+         tmp = quirks->shift_vy ? chip8->V[(chip8->opcode & 0x00F0) >> 4] : chip8->V[(chip8->opcode & 0x0F00) >> 8];
+         chip8->V[(chip8->opcode & 0x0F00) >> 8] = tmp << 1;
+         chip8->V[0xF] = tmp >> 7;
+
+         if (debug == 1) printf("V[%x] = %x. V[0xF] = %x\n",(chip8->opcode & 0x0F00) >> 8,chip8->V[(chip8->opcode & 0x0F00) >> 8],chip8->V[0xF]);
+         chip8->pc = chip8->pc + 2;
+         opfound = 1;
+      break;
+
+      /* 8xyE - SHL Vx {, Vy}
+      Set Vx = Vx SHL 1.
+
+      If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2. */
+
+      case 0x9000:
+         if (chip8->V[(chip8->opcode & 0x0F00) >> 8] != chip8->V[(chip8->opcode & 0x00F0) >> 4])
+         {
+            chip8->pc = chip8->pc + 4;
+         } else {
+            chip8->pc = chip8->pc + 2;
+         }
+
+         if (debug == 1) printf("pc = %x\n",chip8->pc);
+         opfound = 1;
+      break;
+ 
+
+      /* 9XY0 - Skips the next instruction if VX doesn't equal VY. */
+   }
+
+   if (opfound == 0) return ERR_OPCODE;
+
+   /*
+      More accurate and complete instruction set (and general overview of CHIP8) available at http://devernay.free.fr/hacks/chip8/C8TECH10.HTM
+
+      0NNN - Calls RCA 1802 program at address NNN.
+      00CN - Scrolls the screen down N pixels. (SUPER-CHIP)
+      00E0 - Clears the screen.
+      00EE - Returns from a subroutine.
+      00FB - Scrolls the screen right 4 pixels. (SUPER-CHIP)
+      00FC - Scrolls the screen left 4 pixels. (SUPER-CHIP)
+      00FD - Exits the interpreter. (SUPER-CHIP)
+      00FE - Switches to 64x32 low resolution. (SUPER-CHIP)
+      00FF - Switches to 128x64 high resolution. (SUPER-CHIP)
+      1NNN - Jumps to address NNN.
+      2NNN - Calls subroutine at NNN.
+      3XNN - Skips the next instruction if VX equals NN.
+      4XNN - Skips the next instruction if VX doesn't equal NN.
+      5XY0 - Skips the next instruction if VX equals VY.
+      6XNN - Sets VX to NN.
+      7XNN - Adds NN to VX.
+      8XY0 - Sets VX to the value of VY.
+      8XY1 - Sets VX to VX or VY.
+      8XY2 - Sets VX to VX and VY.
+      8XY3 - Sets VX to VX xor VY.
+      8XY4 - Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
+      8XY5 - VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
+      8XY6 - Shifts VX right by one. VF is set to the value of the least significant bit of VX before the shift.[2]
+      8XY7 - Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
+      8XYE - Shifts VX left by one. VF is set to the value of the most significant bit of VX before the shift.[2]
+      9XY0 - Skips the next instruction if VX doesn't equal VY.
+      ANNN - Sets I to the address NNN.
+      BNNN - Jumps to the address NNN plus V0. (BXNN, XNN plus VX, on CHIP-48 and SUPER-CHIP)
+      CXNN - Sets VX to a random number and NN.
+      DXYN - Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels. Each row of 8 pixels is read as bit-coded (with the most significant bit of each byte displayed on the left) starting from memory location I; I value doesn't change after the execution of this instruction. As described above, VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that doesn't happen.
+      DXY0 - Draws a 16x16 sprite, two bytes per row. (SUPER-CHIP)
+      EX9E - Skips the next instruction if the key stored in VX is pressed.
+      EXA1 - Skips the next instruction if the key stored in VX isn't pressed.
+      FX07 - Sets VX to the value of the delay timer.
+      FX0A - A key press is awaited, and then stored in VX.
+      FX15 - Sets the delay timer to VX.
+      FX18 - Sets the sound timer to VX.
+      FX1E - Adds VX to I.[3]
+      FX29 - Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font.
+      FX30 - Sets I to the 8x10 font character for VX. (SUPER-CHIP)
+      FX33 - Stores the Binary-coded decimal representation of VX, with the most significant of three digits at the address in I, the middle digit at I plus 1, and the least significant digit at I plus 2. (In other words, take the decimal representation of VX, place the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.)
+      FX55 - Stores V0 to VX in memory starting at address I.[4]
+      FX65 - Fills V0 to VX with values from memory starting at address I.[4]
+      FX75 - Stores V0 to VX (X < 8) in the RPL user flags. (SUPER-CHIP)
+      FX85 - Fills V0 to VX (X < 8) from the RPL user flags. (SUPER-CHIP)
+   */
+
+   /* Decode */
+
+   /* Execute */
+   return 0;
+}
+
+/* One 60Hz frame: a batch of cycles, then a timer tick. Stops at the first error */
+int EmulateFrame(Chip8 * chip8, int cycles)
+{
+   int i, err;
+
+   for(i=0;i<cycles;i++)
+   {
+      if ((err = EmulateCycle(chip8)) != 0) return err;
+   }
+
+   DecrementTimers(chip8);
+
+   return 0;
+}
+
+/* The screen is already packed, so this is a straight copy */
+void PackFrame(Chip8 * chip8, Frame * frame)
+{
+   memcpy(frame->row, chip8->gfx, sizeof(frame->row));
+   frame->width = SCREEN_WIDTH(chip8);
+   frame->height = SCREEN_HEIGHT(chip8);
+}
+
+/* Identifies the loaded ROM for the quirks database. Trailing zero bytes are dropped, so it is the same hash however the ROM was padded */
+uint64_t ProgramHash(Chip8 * chip8)
+{
+   size_t len = sizeof(chip8->memory) - 0x200;
+
+   while (len > 0 && chip8->memory[0x200 + len - 1] == 0)
+   {
+      len--;
+   }
+
+   return Hash64(&chip8->memory[0x200], len, 0);
+}
+
+/*
+   Everything that decides what the machine does next: memory,
+   registers, stack, timers and screen. Keys, the last opcode and
+   DrawFlag are left out, so states that only differ in those hash
+   the same
+*/
+uint64_t StateHash(Chip8 * chip8)
+{
+   unsigned char cpu[64];
+   uint64_t h;
+   int i;
+
+   h = Hash64(chip8->memory, sizeof(chip8->memory), 0);
+   h = Hash64(chip8->gfx, sizeof(chip8->gfx), h);
+
+   memcpy(cpu, chip8->V, 16);
+   for (i = 0; i < 16; i++)
+   {
+      cpu[16 + 2 * i] = chip8->stack[i] & 0xFF;
+      cpu[17 + 2 * i] = chip8->stack[i] >> 8;
+   }
+   memcpy(cpu + 48, chip8->rpl, 8);
+   cpu[56] = chip8->I & 0xFF;
+   cpu[57] = chip8->I >> 8;
+   cpu[58] = chip8->pc & 0xFF;
+   cpu[59] = chip8->pc >> 8;
+   cpu[60] = chip8->sp;
+   cpu[61] = chip8->delay_timer;
+   cpu[62] = chip8->sound_timer;
+   cpu[63] = chip8->hires;
+
+   return Hash64(cpu, sizeof(cpu), h);
+}
+
+/* Fast non-cryptographic hash, a word at a time */
+uint64_t Hash64(const void * data, size_t len, uint64_t seed)
+{
+   const unsigned char *p = data;
+   uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL);
+   uint64_t w;
+
+   while (len >= 8)
+   {
+      memcpy(&w, p, 8);
+      h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+      h ^= h >> 32;
+      p += 8;
+      len -= 8;
+   }
+
+   w = 0;
+   memcpy(&w, p, len);
+   h = (h ^ w) * 0xC4CEB9FE1A85EC53ULL;
+   h ^= h >> 29;
+   h *= 0xFF51AFD7ED558CCDULL;
+   h ^= h >> 32;
+
+   return h;
+}
+
+/* xorshift64*, for the fuzzers. The state must not be 0 */
+uint64_t Random64(uint64_t * state)
+{
+   uint64_t x = *state;
+
+   x ^= x >> 12;
+   x ^= x << 25;
+   x ^= x >> 27;
+   *state = x;
+
+   return x * 0x2545F4914F6CDD1DULL;
+}
@@ -0,0 +1,68 @@
+/*
+   * @file   cpu.h
+   * @brief  chip-8 CPU core. No SDL, so tools can run it headless
+*/
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame.h"
+#include "quirks.h"
+
+#define CYCLES_PER_FRAME 20 /* Default instructions per frame */
+
+/* EmulateCycle and EmulateFrame return codes, also exiterror codes */
+#define ERR_OPCODE 20
+#define ERR_STACK_OVERFLOW 21
+#define ERR_STACK_UNDERFLOW 22
+#define ERR_EXIT 23 /* 00FD, the ROM asked to quit */
+
+#define BIGFONT 0x50 /* SUPER-CHIP 8x10 font, after the 4x5 one */
+#define ROM_START 0x200
+#define ROM_MAX (4096 - ROM_START) /* Largest ROM that fits in memory */
+
+/* Current screen size in pixels */
+#define SCREEN_WIDTH(chip8) ((chip8)->hires ? 128 : 64)
+#define SCREEN_HEIGHT(chip8) ((chip8)->hires ? 64 : 32)
+
+/*
+   Plain data with no pointers, so a snapshot or restore of the
+   whole machine is a struct copy
+*/
+typedef struct {
+   unsigned short opcode; /* One of 35 opcodes */
+   unsigned char memory[4096]; /* 4K memory */
+   unsigned char V[16]; /* 16 registers V0 .. V15 */
+   unsigned short I; /* Index register */
+   unsigned short pc; /* Program counter */
+   uint64_t gfx[64][2]; /* Graphics, packed rows. Bit 63 of gfx[y][0] is the leftmost pixel */
+   int hires; /* SUPER-CHIP 128x64 mode? Only the top left 64x32 is used otherwise */
+   unsigned char delay_timer;
+   unsigned char sound_timer;
+   unsigned short stack[16]; /* Stacks stack0 .. stack15 */
+   unsigned short sp;  /* Stack pointer */
+   unsigned char key[16]; /* HEX based keypad (0x0-0xF) */
+   unsigned char rpl[8]; /* SUPER-CHIP RPL user flags, FX75/FX85 */
+   int profile; /* Quirk profile, PROFILE_* */
+   int DrawFlag; /* Draw? */
+} Chip8;
+
+extern unsigned char chip8_fontset[80];
+extern unsigned char chip8_bigfont[160];
+
+int exiterror(int err);
+int DecrementTimers(Chip8 * chip8);
+int DebugOutput(Chip8 *chip8);
+int InitCPU(Chip8 *chip8);
+int LoadFile(const char * path, Chip8 * chip8);
+int EmulateCycle(Chip8 * chip8);
+int EmulateFrame(Chip8 * chip8, int cycles);
+void PackFrame(Chip8 * chip8, Frame * frame);
+uint64_t Hash64(const void * data, size_t len, uint64_t seed);
+uint64_t Random64(uint64_t * state);
+uint64_t ProgramHash(Chip8 * chip8);
+uint64_t StateHash(Chip8 * chip8);
+
+#endif
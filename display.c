@@ -0,0 +1,90 @@
+/*
+   * @file   display.c
+   * @brief  SDL 1.2 window output
+   *
+   * Every frame is scaled up on the CPU, block by block, into
+   * the video surface and flipped.
+*/
+#include <stdio.h>
+#include <SDL.h>
+
+#include "display.h"
+
+#define BPP 4
+#define DEPTH 32
+
+static void setpixel(Display * display, int x, int y, Uint32 colour)
+{
+   Uint32 *pixmem32;
+
+   pixmem32 = (Uint32*) display->screen->pixels  + y + x;
+   *pixmem32 = colour;
+}
+
+/* Fill one block x block square. The caller holds the surface lock */
+static int DrawScreen(Display * display, int x, int y, int block, Uint32 colour)
+{
+   int ytimesw;
+   int blocky;
+   int blockx;
+   x = x * block;
+   y = y * block;
+
+   for(blocky=0;blocky<block;blocky++)
+   {
+      ytimesw = y*display->screen->pitch/BPP;
+      for(blockx=0;blockx<block;blockx++)
+      {
+         setpixel(display, blockx + x, (blocky*(display->screen->pitch/BPP)) + ytimesw, colour);
+      }
+   }
+
+   return 0;
+}
+
+/* Draw every pixel of a packed frame, on and off, then flip once */
+int UpdateGraphics(Display * display, Frame * frame)
+{
+   int x, y;
+   int block = WIDTH / frame->width;
+   Uint32 on, off;
+
+   on = SDL_MapRGB(display->screen->format, 128, 128, 128);
+   off = SDL_MapRGB(display->screen->format, 0, 0, 0);
+
+   if (SDL_MUSTLOCK(display->screen))
+   {
+      if(SDL_LockSurface(display->screen) < 0) return 1;
+   }
+
+   for (y = 0; y < frame->height; y++)
+   {
+      for (x = 0; x < frame->width; x++)
+      {
+         DrawScreen(display,x,y,block,((frame->row[y][x >> 6] >> (63 - (x & 63))) & 1) ? on : off);
+      }
+   }
+
+   if(SDL_MUSTLOCK(display->screen)) SDL_UnlockSurface(display->screen);
+   SDL_Flip(display->screen);
+
+   return 0;
+}
+
+int InitScreen(Display * display)
+{
+   if (SDL_Init(SDL_INIT_VIDEO) < 0 ) return 1;
+
+   if (!(display->screen = SDL_SetVideoMode(WIDTH, HEIGHT, DEPTH, SDL_HWSURFACE)))
+   {
+      SDL_Quit();
+      return 1;
+   }
+
+   return 0;
+}
+
+void QuitScreen(Display * display)
+{
+   display->screen = NULL;
+}
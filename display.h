@@ -0,0 +1,39 @@
+/*
+   * @file   display.h
+   * @brief  Window output. display.c draws with SDL 1.2,
+   *         display_sdl2.c with an SDL2 streaming texture.
+   *         The Makefile picks one at build time
+*/
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <SDL.h>
+
+#include "frame.h"
+
+#define WIDTH 640
+#define HEIGHT 320
+
+#if SDL_VERSION_ATLEAST(2,0,0)
+typedef SDL_Keycode SDLKey;
+
+typedef struct {
+   SDL_Window *window;
+   SDL_Renderer *renderer;
+   SDL_Texture *texture; /* FRAME_WIDTH x FRAME_HEIGHT, only the top left frame size is used */
+   SDL_Rect source; /* Part of the texture the last frame went into */
+   Uint32 pixels[FRAME_WIDTH * FRAME_HEIGHT]; /* One frame converted to ARGB */
+} Display;
+
+int RedrawScreen(Display * display);
+#else
+typedef struct {
+   SDL_Surface *screen;
+} Display;
+#endif
+
+int InitScreen(Display * display);
+int UpdateGraphics(Display * display, Frame * frame);
+void QuitScreen(Display * display);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+   * @file   display_sdl2.c
+   * @brief  SDL2 window output through a streaming texture
+   *
+   * The frame goes up at its own size, 64x32 or 128x64, as one
+   * SDL_UpdateTexture per frame. SDL_RenderCopy scales it to the
+   * window with nearest neighbour sampling, so the CPU never
+   * touches a scaled pixel. Works on the software renderer too.
+*/
+#include <stdio.h>
+#include <SDL.h>
+
+#include "display.h"
+
+#define ON 0xFF808080 /* ARGB */
+#define OFF 0xFF000000
+
+int InitScreen(Display * display)
+{
+   int i;
+
+   display->window = NULL;
+   display->renderer = NULL;
+   display->texture = NULL;
+   display->source.x = 0;
+   display->source.y = 0;
+   display->source.w = FRAME_WIDTH / 2;
+   display->source.h = FRAME_HEIGHT / 2;
+
+   if (SDL_Init(SDL_INIT_VIDEO) < 0) return 1;
+
+   /* Must be set before the texture is created */
+   SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+
+   /* The renderer falls back to software when there is no GPU */
+   if ((display->window = SDL_CreateWindow("chip-8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+         WIDTH, HEIGHT, SDL_WINDOW_RESIZABLE)) != NULL
+      && (display->renderer = SDL_CreateRenderer(display->window, -1, 0)) != NULL
+      && (display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888,
+         SDL_TEXTUREACCESS_STREAMING, FRAME_WIDTH, FRAME_HEIGHT)) != NULL)
+   {
+      /* Start blank, in case the window is redrawn before the first frame */
+      for (i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++)
+      {
+         display->pixels[i] = OFF;
+      }
+      if (SDL_UpdateTexture(display->texture, NULL, display->pixels, FRAME_WIDTH * sizeof(Uint32)) == 0) return 0;
+   }
+
+   QuitScreen(display);
+   SDL_Quit();
+   return 1;
+}
+
+/* Unpack to ARGB at 1:1 and upload. Low resolution only fills the top left of the texture */
+int UpdateGraphics(Display * display, Frame * frame)
+{
+   Uint32 *out = display->pixels;
+   uint64_t bits = 0;
+   int x, y;
+
+   for (y = 0; y < frame->height; y++)
+   {
+      for (x = 0; x < frame->width; x++)
+      {
+         if ((x & 63) == 0) bits = frame->row[y][x >> 6];
+         *out++ = (bits >> 63) ? ON : OFF;
+         bits <<= 1;
+      }
+   }
+
+   display->source.w = frame->width;
+   display->source.h = frame->height;
+   if (SDL_UpdateTexture(display->texture, &display->source, display->pixels, frame->width * sizeof(Uint32)) < 0) return 1;
+
+   return RedrawScreen(display);
+}
+
+/* Present the last uploaded frame again, after the window was resized or uncovered */
+int RedrawScreen(Display * display)
+{
+   if (SDL_RenderCopy(display->renderer, display->texture, &display->source, NULL) < 0) return 1;
+   SDL_RenderPresent(display->renderer);
+
+   return 0;
+}
+
+void QuitScreen(Display * display)
+{
+   if (display->texture != NULL) SDL_DestroyTexture(display->texture);
+   if (display->renderer != NULL) SDL_DestroyRenderer(display->renderer);
+   if (display->window != NULL) SDL_DestroyWindow(display->window);
+
+   display->texture = NULL;
+   display->renderer = NULL;
+   display->window = NULL;
+}
@@ -0,0 +1,309 @@
+/*
+   * @file   engine.c
+   * @brief  Table dispatch interpreter
+   *
+   * EmulateCycle in cpu.c walks up to four switch statements
+   * per instruction. Here the top nibble indexes a table of
+   * handlers, each of which decodes its own group. Behaviour
+   * must match cpu.c exactly, including the order VF is written
+   * in, so tests/difffuzz can compare the two step by step.
+   *
+   * Handlers that depend on quirks live in engine_profile.h,
+   * which is stamped out once per profile below.
+*/
+#include <string.h>
+
+#include "engine.h"
+
+#define X ((opcode & 0x0F00) >> 8)
+#define Y ((opcode & 0x00F0) >> 4)
+#define NN (opcode & 0x00FF)
+#define NNN (opcode & 0x0FFF)
+
+typedef int (*Handler)(Chip8 * chip8, unsigned short opcode);
+
+/* 00CN, 00FB and 00FC move whole rows, never single pixels */
+static void ScrollDown(Chip8 * chip8, unsigned int n)
+{
+   unsigned int height = SCREEN_HEIGHT(chip8);
+
+   if (n > height) n = height;
+   memmove(chip8->gfx[n], chip8->gfx[0], (height - n) * sizeof(chip8->gfx[0]));
+   memset(chip8->gfx[0], 0, n * sizeof(chip8->gfx[0]));
+}
+
+static void ScrollRight(Chip8 * chip8)
+{
+   unsigned int y, height = SCREEN_HEIGHT(chip8);
+
+   for (y = 0; y < height; y++)
+   {
+      chip8->gfx[y][1] = (chip8->gfx[y][1] >> 4) | (chip8->gfx[y][0] << 60);
+      chip8->gfx[y][0] >>= 4;
+   }
+
+   /* Low resolution stops at 64 pixels, word 1 stays clear */
+   if (!chip8->hires)
+   {
+      for (y = 0; y < height; y++)
+      {
+         chip8->gfx[y][1] = 0;
+      }
+   }
+}
+
+static void ScrollLeft(Chip8 * chip8)
+{
+   unsigned int y, height = SCREEN_HEIGHT(chip8);
+
+   for (y = 0; y < height; y++)
+   {
+      chip8->gfx[y][0] = (chip8->gfx[y][0] << 4) | (chip8->gfx[y][1] >> 60);
+      chip8->gfx[y][1] <<= 4;
+   }
+}
+
+static int Op0(Chip8 * chip8, unsigned short opcode)
+{
+   if ((opcode & 0xFFF0) == 0x00C0)
+   {
+      ScrollDown(chip8, opcode & 0x000F);
+      chip8->DrawFlag = 1;
+      chip8->pc += 2;
+      return 0;
+   }
+
+   switch(opcode)
+   {
+      case 0x00E0:
+         memset(chip8->gfx, 0, sizeof(chip8->gfx));
+         chip8->DrawFlag = 1;
+         chip8->pc += 2;
+         return 0;
+
+      case 0x00EE:
+         if (chip8->sp == 0) return ERR_STACK_UNDERFLOW;
+         chip8->sp--;
+         chip8->pc = chip8->stack[chip8->sp] + 2;
+         return 0;
+
+      case 0x00FB:
+         ScrollRight(chip8);
+         chip8->DrawFlag = 1;
+         chip8->pc += 2;
+         return 0;
+
+      case 0x00FC:
+         ScrollLeft(chip8);
+         chip8->DrawFlag = 1;
+         chip8->pc += 2;
+         return 0;
+
+      case 0x00FD:
+         return ERR_EXIT;
+
+      case 0x00FE:
+      case 0x00FF:
+         chip8->hires = opcode & 1;
+         memset(chip8->gfx, 0, sizeof(chip8->gfx));
+         chip8->DrawFlag = 1;
+         chip8->pc += 2;
+         return 0;
+   }
+
+   return ERR_OPCODE;
+}
+
+static int Op1(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->pc = NNN;
+   return 0;
+}
+
+static int Op2(Chip8 * chip8, unsigned short opcode)
+{
+   if (chip8->sp >= 16) return ERR_STACK_OVERFLOW;
+   chip8->stack[chip8->sp++] = chip8->pc;
+   chip8->pc = NNN;
+   return 0;
+}
+
+static int Op3(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->pc += (chip8->V[X] == NN) ? 4 : 2;
+   return 0;
+}
+
+static int Op4(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->pc += (chip8->V[X] != NN) ? 4 : 2;
+   return 0;
+}
+
+static int Op5(Chip8 * chip8, unsigned short opcode)
+{
+   if ((opcode & 0x000F) != 0) return ERR_OPCODE;
+   chip8->pc += (chip8->V[X] == chip8->V[Y]) ? 4 : 2;
+   return 0;
+}
+
+static int Op6(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->V[X] = NN;
+   chip8->pc += 2;
+   return 0;
+}
+
+static int Op7(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->V[X] += NN;
+   chip8->pc += 2;
+   return 0;
+}
+
+static int Op9(Chip8 * chip8, unsigned short opcode)
+{
+   if ((opcode & 0x000F) != 0) return ERR_OPCODE;
+   chip8->pc += (chip8->V[X] != chip8->V[Y]) ? 4 : 2;
+   return 0;
+}
+
+static int OpA(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->I = NNN;
+   chip8->pc += 2;
+   return 0;
+}
+
+static int OpC(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->V[X] = 9 & NN;
+   chip8->pc += 2;
+   return 0;
+}
+
+/*
+   Draws a whole sprite row at a time. The row is lined up against
+   the 128-bit screen row as two words, so collision test and XOR
+   are two ANDs and two XORs. Bits past the right edge fall off.
+*/
+static int OpD(Chip8 * chip8, unsigned short opcode)
+{
+   unsigned int width = SCREEN_WIDTH(chip8);
+   unsigned int height = SCREEN_HEIGHT(chip8);
+   unsigned int xcoord, ycoord, rows, bits, i, addr;
+   uint64_t sprite, w0, w1, hit = 0;
+   uint64_t *row;
+
+   rows = opcode & 0x000F;
+   bits = 8;
+   xcoord = chip8->V[X] % width;
+   ycoord = chip8->V[Y] % height;
+   chip8->V[0xF] = 0;
+
+   if (rows == 0)
+   {
+      rows = 16;
+      bits = 16;
+   }
+
+   for (i = 0; i < rows && ycoord + i < height; i++)
+   {
+      if (bits == 16)
+      {
+         addr = chip8->I + 2 * i;
+         sprite = (uint64_t) (chip8->memory[addr & 0xFFF] << 8 | chip8->memory[(addr + 1) & 0xFFF]) << 48;
+      } else {
+         sprite = (uint64_t) chip8->memory[(chip8->I + i) & 0xFFF] << 56;
+      }
+
+      if (xcoord < 64)
+      {
+         w0 = sprite >> xcoord;
+         w1 = xcoord ? sprite << (64 - xcoord) : 0;
+      } else {
+         w0 = 0;
+         w1 = sprite >> (xcoord - 64);
+      }
+
+      if (width == 64) w1 = 0;
+
+      row = chip8->gfx[ycoord + i];
+      hit |= (row[0] & w0) | (row[1] & w1);
+      row[0] ^= w0;
+      row[1] ^= w1;
+   }
+
+   if (hit) chip8->V[0xF] = 1;
+
+   chip8->DrawFlag = 1;
+   chip8->pc += 2;
+   return 0;
+}
+
+static int OpE(Chip8 * chip8, unsigned short opcode)
+{
+   switch(opcode & 0x00FF)
+   {
+      case 0x9E:
+         chip8->pc += (chip8->key[chip8->V[X] & 0xF] != 0) ? 4 : 2;
+         return 0;
+
+      case 0xA1:
+         chip8->pc += (chip8->key[chip8->V[X] & 0xF] != 1) ? 4 : 2;
+         return 0;
+   }
+
+   return ERR_OPCODE;
+}
+
+/* One interpreter per quirk profile. The values must match quirk_profiles in quirks.c, tests/difffuzz checks that they do */
+#define PROFILE Vip
+#define SHIFT_VY 1
+#define INDEX_STEP 1
+#define JUMP_VX 0
+#define VF_RESET 1
+#include "engine_profile.h"
+#undef PROFILE
+#undef SHIFT_VY
+#undef INDEX_STEP
+#undef JUMP_VX
+#undef VF_RESET
+
+#define PROFILE Chip48
+#define SHIFT_VY 0
+#define INDEX_STEP 0
+#define JUMP_VX 1
+#define VF_RESET 0
+#include "engine_profile.h"
+#undef PROFILE
+#undef SHIFT_VY
+#undef INDEX_STEP
+#undef JUMP_VX
+#undef VF_RESET
+
+#define PROFILE Schip
+#define SHIFT_VY 0
+#define INDEX_STEP -1
+#define JUMP_VX 1
+#define VF_RESET 0
+#include "engine_profile.h"
+#undef PROFILE
+#undef SHIFT_VY
+#undef INDEX_STEP
+#undef JUMP_VX
+#undef VF_RESET
+
+/* Indexed by PROFILE_*. The profile is only looked at once per call */
+static int (*const profile_cycle[NPROFILES])(Chip8 * chip8) = { CycleVip, CycleChip48, CycleSchip };
+static int (*const profile_frame[NPROFILES])(Chip8 * chip8, int cycles) = { FrameVip, FrameChip48, FrameSchip };
+
+int EmulateCycleTable(Chip8 * chip8)
+{
+   return profile_cycle[chip8->profile](chip8);
+}
+
+int EmulateFrameTable(Chip8 * chip8, int cycles)
+{
+   return profile_frame[chip8->profile](chip8, cycles);
+}
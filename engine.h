@@ -0,0 +1,14 @@
+/*
+   * @file   engine.h
+   * @brief  Table dispatch interpreter. Same behaviour as
+   *         EmulateCycle in cpu.c, checked by tests/difffuzz
+*/
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "cpu.h"
+
+int EmulateCycleTable(Chip8 * chip8);
+int EmulateFrameTable(Chip8 * chip8, int cycles);
+
+#endif
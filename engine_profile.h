@@ -0,0 +1,205 @@
+/*
+   * @file   engine_profile.h
+   * @brief  The quirk dependent half of engine.c
+   *
+   * Not a normal header. engine.c includes it once per quirk
+   * profile with these defined:
+   *
+   *   PROFILE     suffix for the generated names
+   *   SHIFT_VY    8XY6/8XYE shift VY into VX
+   *   INDEX_STEP  FX55/FX65 leave I at I + X + INDEX_STEP, -1 leaves it
+   *   JUMP_VX     BXNN jumps to XNN + VX
+   *   VF_RESET    8XY1/8XY2/8XY3 clear VF
+   *
+   * They are constants, so each copy is compiled with its quirk
+   * tests folded away. Defines Op8, OpB, OpF, the handler table,
+   * Cycle and Frame, all suffixed with PROFILE.
+*/
+#define STAMP(name) STAMP2(name, PROFILE)
+#define STAMP2(name, profile) STAMP3(name, profile)
+#define STAMP3(name, profile) name##profile
+
+static int STAMP(Op8)(Chip8 * chip8, unsigned short opcode)
+{
+   int tmp;
+
+   /* Flags are written after the result, so VF as VX ends up holding the flag */
+   switch(opcode & 0x000F)
+   {
+      case 0x0:
+         chip8->V[X] = chip8->V[Y];
+      break;
+
+      case 0x1:
+         chip8->V[X] |= chip8->V[Y];
+         if (VF_RESET) chip8->V[0xF] = 0;
+      break;
+
+      case 0x2:
+         chip8->V[X] &= chip8->V[Y];
+         if (VF_RESET) chip8->V[0xF] = 0;
+      break;
+
+      case 0x3:
+         chip8->V[X] ^= chip8->V[Y];
+         if (VF_RESET) chip8->V[0xF] = 0;
+      break;
+
+      case 0x4:
+         tmp = chip8->V[X] + chip8->V[Y];
+         chip8->V[X] = tmp;
+         chip8->V[0xF] = tmp > 255;
+      break;
+
+      case 0x5:
+         tmp = chip8->V[X] >= chip8->V[Y];
+         chip8->V[X] -= chip8->V[Y];
+         chip8->V[0xF] = tmp;
+      break;
+
+      case 0x6:
+         tmp = SHIFT_VY ? chip8->V[Y] : chip8->V[X];
+         chip8->V[X] = tmp >> 1;
+         chip8->V[0xF] = tmp & 1;
+      break;
+
+      case 0x7:
+         tmp = chip8->V[Y] >= chip8->V[X];
+         chip8->V[X] = chip8->V[Y] - chip8->V[X];
+         chip8->V[0xF] = tmp;
+      break;
+
+      case 0xE:
+         tmp = SHIFT_VY ? chip8->V[Y] : chip8->V[X];
+         chip8->V[X] = tmp << 1;
+         chip8->V[0xF] = tmp >> 7;
+      break;
+
+      default:
+         return ERR_OPCODE;
+   }
+
+   chip8->pc += 2;
+   return 0;
+}
+
+static int STAMP(OpB)(Chip8 * chip8, unsigned short opcode)
+{
+   chip8->pc = NNN + (JUMP_VX ? chip8->V[X] : chip8->V[0]);
+   return 0;
+}
+
+static int STAMP(OpF)(Chip8 * chip8, unsigned short opcode)
+{
+   int i;
+
+   switch(opcode & 0x00FF)
+   {
+      case 0x07:
+         chip8->V[X] = chip8->delay_timer;
+      break;
+
+      case 0x0A:
+         /* pc stays put until a key is down */
+         for (i = 0; i < 16; i++)
+         {
+            if (chip8->key[i] != 0)
+            {
+               chip8->V[X] = i;
+               chip8->pc += 2;
+               break;
+            }
+         }
+         return 0;
+
+      case 0x15:
+         chip8->delay_timer = chip8->V[X];
+      break;
+
+      case 0x18:
+         chip8->sound_timer = chip8->V[X];
+      break;
+
+      case 0x1E:
+         chip8->I += chip8->V[X];
+      break;
+
+      case 0x29:
+         chip8->I = chip8->V[X] * 5;
+      break;
+
+      case 0x30:
+         chip8->I = BIGFONT + (chip8->V[X] & 0xF) * 10;
+      break;
+
+      case 0x33:
+         chip8->memory[chip8->I & 0xFFF] = chip8->V[X] / 100;
+         chip8->memory[(chip8->I + 1) & 0xFFF] = (chip8->V[X] / 10) % 10;
+         chip8->memory[(chip8->I + 2) & 0xFFF] = chip8->V[X] % 10;
+      break;
+
+      case 0x55:
+         for (i = 0; i <= X; i++)
+         {
+            chip8->memory[(chip8->I + i) & 0xFFF] = chip8->V[i];
+         }
+         if (INDEX_STEP >= 0) chip8->I += X + INDEX_STEP;
+      break;
+
+      case 0x65:
+         for (i = 0; i <= X; i++)
+         {
+            chip8->V[i] = chip8->memory[(chip8->I + i) & 0xFFF];
+         }
+         if (INDEX_STEP >= 0) chip8->I += X + INDEX_STEP;
+      break;
+
+      case 0x75:
+         memcpy(chip8->rpl, chip8->V, (X & 7) + 1);
+      break;
+
+      case 0x85:
+         memcpy(chip8->V, chip8->rpl, (X & 7) + 1);
+      break;
+
+      default:
+         return ERR_OPCODE;
+   }
+
+   chip8->pc += 2;
+   return 0;
+}
+
+static const Handler STAMP(handlers)[16] =
+{
+   Op0, Op1, Op2, Op3, Op4, Op5, Op6, Op7,
+   STAMP(Op8), Op9, OpA, STAMP(OpB), OpC, OpD, OpE, STAMP(OpF)
+};
+
+static int STAMP(Cycle)(Chip8 * chip8)
+{
+   unsigned short opcode;
+
+   opcode = chip8->memory[chip8->pc & 0xFFF] << 8 | chip8->memory[(chip8->pc + 1) & 0xFFF];
+   chip8->opcode = opcode;
+
+   return STAMP(handlers)[opcode >> 12](chip8, opcode);
+}
+
+static int STAMP(Frame)(Chip8 * chip8, int cycles)
+{
+   int i, err;
+
+   for (i = 0; i < cycles; i++)
+   {
+      if ((err = STAMP(Cycle)(chip8)) != 0) return err;
+   }
+
+   DecrementTimers(chip8);
+
+   return 0;
+}
+
+#undef STAMP
+#undef STAMP2
+#undef STAMP3
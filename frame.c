@@ -0,0 +1,43 @@
+/*
+   * @file   frame.c
+   * @brief  Lock-free triple buffer of packed framebuffers
+*/
+#include <string.h>
+
+#include "frame.h"
+
+void InitTripleBuffer(TripleBuffer * tb)
+{
+   memset(tb->slot, 0, sizeof(tb->slot));
+   tb->back = 0;
+   tb->middle = 1;
+   tb->front = 2;
+}
+
+/* Slot the producer may write the next frame into */
+Frame * BackFrame(TripleBuffer * tb)
+{
+   return &tb->slot[tb->back];
+}
+
+/* Hand the back slot over, replacing any frame the consumer never picked up */
+void PublishFrame(TripleBuffer * tb)
+{
+   unsigned int old;
+
+   old = __atomic_exchange_n(&tb->middle, tb->back | FRAME_FRESH, __ATOMIC_ACQ_REL);
+   tb->back = old & 3;
+}
+
+/* Newest published frame, or NULL if nothing new since the last call */
+Frame * LatestFrame(TripleBuffer * tb)
+{
+   unsigned int old;
+
+   if ((__atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & FRAME_FRESH) == 0) return NULL;
+
+   old = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL);
+   tb->front = old & 3;
+
+   return &tb->slot[tb->front];
+}
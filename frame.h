@@ -0,0 +1,42 @@
+/*
+   * @file   frame.h
+   * @brief  Packed framebuffers and the triple buffer that
+   *         hands them from the emulator to the renderer
+*/
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+/* Largest frame, SUPER-CHIP high resolution. Low resolution is 64x32 */
+#define FRAME_WIDTH 128
+#define FRAME_HEIGHT 64
+
+typedef struct {
+   uint64_t row[FRAME_HEIGHT][2]; /* One bit per pixel, bit 63 of row[y][0] is the leftmost */
+   int width; /* 64 or 128 */
+   int height; /* 32 or 64 */
+   unsigned long number; /* Emulated frame this was taken on */
+} Frame;
+
+/*
+   Three slots: the producer owns back, the consumer owns front
+   and the third sits in middle waiting to be picked up. Both
+   sides only ever swap their own slot with middle, so neither
+   can block the other.
+*/
+typedef struct {
+   Frame slot[3];
+   int back; /* Producer side */
+   int front; /* Consumer side */
+   unsigned int middle; /* Shared. Slot index, plus FRAME_FRESH if not yet picked up */
+} TripleBuffer;
+
+#define FRAME_FRESH 4
+
+void InitTripleBuffer(TripleBuffer * tb);
+Frame * BackFrame(TripleBuffer * tb);
+void PublishFrame(TripleBuffer * tb);
+Frame * LatestFrame(TripleBuffer * tb);
+
+#endif
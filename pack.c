@@ -0,0 +1,174 @@
+/*
+   * @file   pack.c
+   * @brief  ROM corpus packs, many ROMs in one memory mapped file
+   *
+   * Opening a corpus of small files one by one costs more than
+   * running most of them. A pack is opened and mapped once, and a
+   * ROM is loaded straight from the mapping into Chip8.memory.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pack.h"
+
+/* Everything a lookup or load relies on, so nothing is checked after this */
+static int CheckPack(const Pack * pack)
+{
+   const PackHeader *header = (const PackHeader *) pack->data;
+   const PackEntry *e;
+   uint32_t i;
+
+   if (pack->size < sizeof(PackHeader)) return 1;
+   if (header->magic != PACK_MAGIC || header->order != PACK_ORDER || header->version != PACK_VERSION) return 1;
+   if (header->index < sizeof(PackHeader) || header->index > pack->size || header->index % 8 != 0) return 1;
+   if (header->count > (pack->size - header->index) / sizeof(PackEntry)) return 1;
+
+   e = (const PackEntry *) (pack->data + header->index);
+   for (i = 0; i < header->count; i++, e++)
+   {
+      if (memchr(e->name, 0, PACK_NAME) == NULL || e->name[0] == 0) return 1;
+      if (e->size == 0 || e->size > ROM_MAX) return 1;
+      if (e->offset < sizeof(PackHeader) || e->offset > header->index || e->size > header->index - e->offset) return 1;
+      if (e->profile < -1 || e->profile >= NPROFILES || e->cycles < 0) return 1;
+      if (i > 0 && e[-1].hash > e->hash) return 1;
+   }
+
+   return 0;
+}
+
+/* Returns non zero if the file can't be mapped or fails a check */
+int OpenPack(Pack * pack, const char * path)
+{
+   struct stat st;
+   void *data;
+   int fd;
+
+   pack->data = NULL;
+   pack->size = 0;
+   pack->entries = NULL;
+   pack->count = 0;
+
+   if ((fd = open(path, O_RDONLY)) == -1) return 1;
+   if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(PackHeader))
+   {
+      close(fd);
+      return 1;
+   }
+
+   data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED) return 1;
+
+   pack->data = data;
+   pack->size = st.st_size;
+   if (CheckPack(pack) != 0)
+   {
+      ClosePack(pack);
+      return 1;
+   }
+
+   pack->count = ((const PackHeader *) data)->count;
+   pack->entries = (const PackEntry *) (pack->data + ((const PackHeader *) data)->index);
+
+   return 0;
+}
+
+void ClosePack(Pack * pack)
+{
+   if (pack->data != NULL) munmap((void *) pack->data, pack->size);
+
+   pack->data = NULL;
+   pack->size = 0;
+   pack->entries = NULL;
+   pack->count = 0;
+}
+
+/* Binary search on the sorted index. NULL if absent */
+const PackEntry * FindPackHash(const Pack * pack, uint64_t hash)
+{
+   uint32_t lo = 0, hi = pack->count, mid;
+
+   while (lo < hi)
+   {
+      mid = lo + (hi - lo) / 2;
+      if (pack->entries[mid].hash < hash)
+      {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   return (lo < pack->count && pack->entries[lo].hash == hash) ? &pack->entries[lo] : NULL;
+}
+
+const PackEntry * FindPackName(const Pack * pack, const char * name)
+{
+   uint32_t i;
+
+   for (i = 0; i < pack->count; i++)
+   {
+      if (strcmp(pack->entries[i].name, name) == 0) return &pack->entries[i];
+   }
+
+   return NULL;
+}
+
+/* A name, or failing that a hash in hex as printed by the emulator */
+const PackEntry * FindPack(const Pack * pack, const char * key)
+{
+   const PackEntry *entry;
+   char *end;
+   uint64_t hash;
+
+   if ((entry = FindPackName(pack, key)) != NULL) return entry;
+
+   hash = strtoull(key, &end, 16);
+   if (*key == 0 || *end != 0) return NULL;
+
+   return FindPackHash(pack, hash);
+}
+
+/* Copies the image to 0x200 and applies its profile. Call after InitCPU */
+int LoadPacked(Chip8 * chip8, const Pack * pack, const PackEntry * entry)
+{
+   memcpy(&chip8->memory[ROM_START], pack->data + entry->offset, entry->size);
+   if (entry->profile >= 0) chip8->profile = entry->profile;
+
+   return 0;
+}
+
+/*
+   A ROM file, or with a pack path the ROM of that name or hash in
+   it. Call after InitCPU. The pack's profile and cycles fill in
+   *profile and *cycles unless already set. Returns 0 or an
+   exiterror code
+*/
+int LoadROM(Chip8 * chip8, const char * packpath, const char * rom, int * profile, int * cycles)
+{
+   Pack pack;
+   const PackEntry *entry;
+
+   if (packpath == NULL) return LoadFile(rom, chip8);
+
+   if (OpenPack(&pack, packpath) != 0) return 2;
+   if ((entry = FindPack(&pack, rom)) == NULL)
+   {
+      ClosePack(&pack);
+      return 7;
+   }
+
+   LoadPacked(chip8, &pack, entry);
+   if (*profile < 0) *profile = entry->profile;
+   if (*cycles <= 0) *cycles = entry->cycles;
+   ClosePack(&pack);
+
+   return 0;
+}
@@ -0,0 +1,63 @@
+/*
+   * @file   pack.h
+   * @brief  ROM corpus packs, many ROMs in one memory mapped file
+   *
+   * Layout, all fields in the byte order of the host that wrote it:
+   *
+   *   PackHeader
+   *   ROM images, back to back
+   *   PackEntry[count], sorted by hash
+   *
+   * OpenPack maps the file and checks every entry against the
+   * file size once, so lookups and loads trust the index after
+   * that. Packs are mapped and used in place, so a pack from a host
+   * of the other byte order is rejected rather than converted.
+   * tools/mkpack writes packs.
+*/
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cpu.h"
+
+#define PACK_MAGIC 0x4B503843 /* "C8PK" on a little endian host */
+#define PACK_VERSION 2
+#define PACK_ORDER 0x01020304 /* Reads back as 0x04030201 with the other byte order */
+#define PACK_NAME 48 /* Bytes for a ROM name, including the NUL */
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t count; /* Entries in the index */
+   uint32_t order; /* PACK_ORDER as the writer stored it */
+   uint64_t index; /* Byte offset of the index */
+} PackHeader;
+
+typedef struct {
+   char name[PACK_NAME]; /* File name without directory or extension */
+   uint64_t hash; /* ProgramHash() of the loaded ROM */
+   uint64_t offset; /* Byte offset of the image */
+   uint32_t size; /* 1 .. ROM_MAX */
+   int32_t profile; /* PROFILE_*, -1 if unknown */
+   int32_t cycles; /* Instructions per frame, 0 for the default */
+   uint32_t reserved;
+} PackEntry;
+
+typedef struct {
+   const unsigned char *data; /* The whole file, mapped read only */
+   size_t size;
+   const PackEntry *entries;
+   uint32_t count;
+} Pack;
+
+int OpenPack(Pack * pack, const char * path);
+void ClosePack(Pack * pack);
+const PackEntry * FindPackHash(const Pack * pack, uint64_t hash);
+const PackEntry * FindPackName(const Pack * pack, const char * name);
+const PackEntry * FindPack(const Pack * pack, const char * key);
+int LoadPacked(Chip8 * chip8, const Pack * pack, const PackEntry * entry);
+int LoadROM(Chip8 * chip8, const char * packpath, const char * rom, int * profile, int * cycles);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+   * @file   quirks.c
+   * @brief  Interpreter quirk profiles and the ROM hash database
+   *
+   * The database is a text file of "hash profile name" lines,
+   * hash being ProgramHash() of the loaded ROM in hex. The name
+   * is only there for people reading the file.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "quirks.h"
+
+const Quirks quirk_profiles[NPROFILES] =
+{
+   /* name      shift_vy  index_step  jump_vx  vf_reset */
+   { "vip",     1,        1,          0,       1 },
+   { "chip48",  0,        0,          1,       0 },
+   { "schip",   0,        -1,         1,       0 },
+};
+
+/* Returns -1 for an unknown name */
+int ProfileByName(const char * name)
+{
+   int i;
+
+   for (i = 0; i < NPROFILES; i++)
+   {
+      if (strcmp(name, quirk_profiles[i].name) == 0) return i;
+   }
+
+   return -1;
+}
+
+/* Returns -1 if the database is missing or doesn't list the ROM */
+int LookupProfile(const char * db, uint64_t hash)
+{
+   FILE *file;
+   char line[256];
+   char name[64];
+   uint64_t h;
+   int profile = -1;
+
+   if ((file = fopen(db, "r")) == NULL) return -1;
+
+   while (fgets(line, sizeof(line), file) != NULL)
+   {
+      if (line[0] == '#' || line[0] == '\n') continue;
+      if (sscanf(line, "%" SCNx64 " %63s", &h, name) == 2 && h == hash)
+      {
+         profile = ProfileByName(name);
+         break;
+      }
+   }
+   fclose(file);
+
+   return profile;
+}
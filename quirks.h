@@ -0,0 +1,38 @@
+/*
+   * @file   quirks.h
+   * @brief  Interpreter quirk profiles and the ROM hash database
+   *         that picks one per ROM
+   *
+   * CHIP-8 interpreters disagree on a handful of instructions.
+   * EmulateCycle reads the flags below at run time. engine.c
+   * compiles one interpreter per profile with the flags as
+   * constants, so its hot loop never tests them.
+*/
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <stdint.h>
+
+/* Profiles, index into quirk_profiles */
+#define PROFILE_VIP 0 /* COSMAC VIP, the original interpreter */
+#define PROFILE_CHIP48 1 /* CHIP-48 on the HP-48 */
+#define PROFILE_SCHIP 2 /* SUPER-CHIP 1.1 */
+#define NPROFILES 3
+
+#define PROFILE_DEFAULT PROFILE_SCHIP
+#define QUIRKS_DB "quirks.db" /* Default ROM database */
+
+typedef struct {
+   const char *name; /* Used on the command line and in the database */
+   int shift_vy; /* 8XY6/8XYE shift VY into VX, rather than VX in place */
+   int index_step; /* FX55/FX65 leave I at I + X + index_step. -1 leaves I alone */
+   int jump_vx; /* BXNN jumps to XNN + VX, rather than BNNN to NNN + V0 */
+   int vf_reset; /* 8XY1/8XY2/8XY3 clear VF */
+} Quirks;
+
+extern const Quirks quirk_profiles[NPROFILES];
+
+int ProfileByName(const char * name);
+int LookupProfile(const char * db, uint64_t hash);
+
+#endif
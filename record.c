@@ -0,0 +1,325 @@
+/*
+   * @file   record.c
+   * @brief  Capture emulated frames to a Y4M video or a PNG
+   *         sequence on a background thread
+   *
+   * The emulator only copies a packed frame, about 1 KB with its
+   * dimensions, into the queue. Upscaling and encoding happen on the writer thread.
+   * When the writer falls behind, new frames are dropped and
+   * counted rather than holding up emulation.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "record.h"
+
+#define OUT_WIDTH RECORD_WIDTH
+#define OUT_HEIGHT RECORD_HEIGHT
+
+#define Y4M_ON 235
+#define Y4M_OFF 16
+
+static unsigned long crctable[256];
+
+/* Both resolutions scale up to the same output size */
+static int Pixel(Frame * frame, int x, int y)
+{
+   x = x * frame->width / OUT_WIDTH;
+   y = y * frame->height / OUT_HEIGHT;
+
+   return (frame->row[y][x >> 6] >> (63 - (x & 63))) & 1;
+}
+
+static int WriteY4M(Recorder * rec, Frame * frame)
+{
+   int x, y;
+
+   if (fputs("FRAME\n", rec->file) == EOF) return 1;
+
+   /* Luma */
+   for (y = 0; y < OUT_HEIGHT; y++)
+   {
+      for (x = 0; x < OUT_WIDTH; x++)
+      {
+         rec->line[x] = Pixel(frame, x, y) ? Y4M_ON : Y4M_OFF;
+      }
+      if (fwrite(rec->line, 1, OUT_WIDTH, rec->file) != OUT_WIDTH) return 1;
+   }
+
+   /* Flat 4:2:0 chroma, two planes */
+   memset(rec->line, 128, OUT_WIDTH / 2);
+   for (y = 0; y < OUT_HEIGHT; y++)
+   {
+      if (fwrite(rec->line, 1, OUT_WIDTH / 2, rec->file) != OUT_WIDTH / 2) return 1;
+   }
+
+   return 0;
+}
+
+static void InitCRC(void)
+{
+   unsigned long c;
+   int n, k;
+
+   for (n = 0; n < 256; n++)
+   {
+      c = n;
+      for (k = 0; k < 8; k++)
+      {
+         c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+      }
+      crctable[n] = c;
+   }
+}
+
+static unsigned long CRC(unsigned long crc, unsigned char * buf, int len)
+{
+   int i;
+
+   for (i = 0; i < len; i++)
+   {
+      crc = crctable[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+   }
+
+   return crc;
+}
+
+static void Put32(unsigned char * p, unsigned long v)
+{
+   p[0] = (v >> 24) & 0xFF;
+   p[1] = (v >> 16) & 0xFF;
+   p[2] = (v >> 8) & 0xFF;
+   p[3] = v & 0xFF;
+}
+
+static int WriteChunk(FILE * file, const char * type, unsigned char * data, int len)
+{
+   unsigned char head[8];
+   unsigned char tail[4];
+   unsigned long crc;
+
+   Put32(head, len);
+   memcpy(head + 4, type, 4);
+   crc = CRC(0xFFFFFFFFUL, head + 4, 4);
+   crc = CRC(crc, data, len) ^ 0xFFFFFFFFUL;
+   Put32(tail, crc);
+
+   if (fwrite(head, 1, 8, file) != 8) return 1;
+   if (len > 0 && fwrite(data, 1, len, file) != (size_t) len) return 1;
+   if (fwrite(tail, 1, 4, file) != 4) return 1;
+
+   return 0;
+}
+
+/*
+   1 bit greyscale. A whole image is under 26K raw, so it fits in
+   one stored (uncompressed) deflate block and needs no zlib.
+*/
+static int WritePNG(Recorder * rec, Frame * frame)
+{
+   static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+   unsigned char ihdr[13];
+   unsigned char *idat = rec->line;
+   unsigned char *raw;
+   unsigned long a = 1, b = 0;
+   char name[4096];
+   FILE *file;
+   int stride = OUT_WIDTH / 8 + 1;
+   int rawlen = stride * OUT_HEIGHT;
+   int x, y, i, err = 0;
+
+   snprintf(name, sizeof(name), "%s%06lu.png", rec->path, frame->number);
+   if ((file = fopen(name, "wb")) == NULL) return 1;
+
+   Put32(ihdr, OUT_WIDTH);
+   Put32(ihdr + 4, OUT_HEIGHT);
+   ihdr[8] = 1; /* Bit depth */
+   ihdr[9] = 0; /* Greyscale */
+   ihdr[10] = 0;
+   ihdr[11] = 0;
+   ihdr[12] = 0;
+
+   /* zlib header, then a single final stored block */
+   idat[0] = 0x78;
+   idat[1] = 0x01;
+   idat[2] = 0x01;
+   idat[3] = rawlen & 0xFF;
+   idat[4] = rawlen >> 8;
+   idat[5] = ~rawlen & 0xFF;
+   idat[6] = (~rawlen >> 8) & 0xFF;
+   raw = idat + 7;
+
+   memset(raw, 0, rawlen);
+   for (y = 0; y < OUT_HEIGHT; y++)
+   {
+      /* raw[y * stride] is the filter byte, left as 0 (none) */
+      for (x = 0; x < OUT_WIDTH; x++)
+      {
+         if (Pixel(frame, x, y)) raw[y * stride + 1 + x / 8] |= 0x80 >> (x % 8);
+      }
+   }
+
+   for (i = 0; i < rawlen; i++)
+   {
+      a = (a + raw[i]) % 65521;
+      b = (b + a) % 65521;
+   }
+   Put32(raw + rawlen, (b << 16) | a);
+
+   if (fwrite(signature, 1, 8, file) != 8) err = 1;
+   if (!err) err = WriteChunk(file, "IHDR", ihdr, 13);
+   if (!err) err = WriteChunk(file, "IDAT", idat, 7 + rawlen + 4);
+   if (!err) err = WriteChunk(file, "IEND", NULL, 0);
+   if (fclose(file) != 0) err = 1;
+
+   return err;
+}
+
+static int WriterThread(void * data)
+{
+   Recorder *rec = data;
+   Frame *frame;
+   unsigned int head;
+   int err;
+
+   for (;;)
+   {
+      SDL_SemWait(rec->ready);
+
+      head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+      if (rec->tail == head)
+      {
+         if (__atomic_load_n(&rec->quit, __ATOMIC_ACQUIRE)) break;
+         continue;
+      }
+
+      frame = &rec->queue[rec->tail & (rec->depth - 1)];
+      if (!rec->failed)
+      {
+         if (rec->format == RECORD_Y4M)
+         {
+            err = WriteY4M(rec, frame);
+         } else {
+            err = WritePNG(rec, frame);
+         }
+
+         if (err)
+         {
+            printf("Error 3: Error writing recording, stopping capture\n");
+            rec->failed = 1;
+         } else {
+            rec->written++;
+         }
+      }
+      __atomic_store_n(&rec->tail, rec->tail + 1, __ATOMIC_RELEASE);
+   }
+
+   return 0;
+}
+
+/* Releases what StartRecorder acquired. The writer must be stopped or never started */
+static void FreeRecorder(Recorder * rec)
+{
+   if (rec->ready != NULL) SDL_DestroySemaphore(rec->ready);
+   if (rec->file != NULL) fclose(rec->file);
+   free(rec->queue);
+   free(rec->line);
+
+   rec->ready = NULL;
+   rec->file = NULL;
+   rec->queue = NULL;
+   rec->line = NULL;
+}
+
+int StartRecorder(Recorder * rec, const char * path, int format, unsigned int depth)
+{
+   unsigned int d = 1;
+
+   while (d < depth)
+   {
+      d = d << 1;
+   }
+
+   rec->depth = d;
+   rec->head = 0;
+   rec->tail = 0;
+   rec->format = format;
+   rec->path = path;
+   rec->file = NULL;
+   rec->quit = 0;
+   rec->failed = 0;
+   rec->written = 0;
+   rec->dropped = 0;
+   rec->ready = NULL;
+   rec->thread = NULL;
+
+   rec->queue = malloc(rec->depth * sizeof(Frame));
+
+   /* Big enough for a Y4M scanline or a whole PNG IDAT */
+   rec->line = malloc(7 + (OUT_WIDTH / 8 + 1) * OUT_HEIGHT + 4);
+
+   if (rec->queue == NULL || rec->line == NULL)
+   {
+      FreeRecorder(rec);
+      return 1;
+   }
+
+   if (format == RECORD_Y4M)
+   {
+      if ((rec->file = fopen(path, "wb")) == NULL)
+      {
+         FreeRecorder(rec);
+         return 1;
+      }
+      fprintf(rec->file, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n", OUT_WIDTH, OUT_HEIGHT);
+   } else {
+      InitCRC();
+   }
+
+   if ((rec->ready = SDL_CreateSemaphore(0)) == NULL)
+   {
+      FreeRecorder(rec);
+      return 1;
+   }
+#if SDL_VERSION_ATLEAST(2,0,0)
+   rec->thread = SDL_CreateThread(WriterThread, "recorder", rec);
+#else
+   rec->thread = SDL_CreateThread(WriterThread, rec);
+#endif
+   if (rec->thread == NULL)
+   {
+      FreeRecorder(rec);
+      return 1;
+   }
+
+   return 0;
+}
+
+/* Called by the emulator once per frame. Never blocks */
+void RecordFrame(Recorder * rec, Frame * frame)
+{
+   unsigned int tail;
+
+   tail = __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE);
+   if (rec->head - tail >= rec->depth)
+   {
+      rec->dropped++;
+      return;
+   }
+
+   rec->queue[rec->head & (rec->depth - 1)] = *frame;
+   __atomic_store_n(&rec->head, rec->head + 1, __ATOMIC_RELEASE);
+   SDL_SemPost(rec->ready);
+}
+
+/* Encode whatever is still queued, then shut the writer down */
+void StopRecorder(Recorder * rec)
+{
+   __atomic_store_n(&rec->quit, 1, __ATOMIC_RELEASE);
+   SDL_SemPost(rec->ready);
+   SDL_WaitThread(rec->thread, NULL);
+
+   FreeRecorder(rec);
+}
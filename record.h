@@ -0,0 +1,43 @@
+/*
+   * @file   record.h
+   * @brief  Capture emulated frames to a Y4M video or a PNG
+   *         sequence on a background thread
+*/
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdio.h>
+#include <SDL.h>
+
+#include "frame.h"
+
+#define RECORD_Y4M 1
+#define RECORD_PNG 2
+
+#define RECORD_WIDTH 640 /* Output size, 10x low or 5x high resolution */
+#define RECORD_HEIGHT 320
+#define RECORD_QUEUE 256 /* Default queue depth in frames, power of two */
+#define RECORD_QUEUE_MAX 65536 /* Largest --record-queue */
+
+typedef struct {
+   Frame *queue; /* Bounded queue of packed frames */
+   unsigned int depth; /* Queue depth, power of two */
+   unsigned int head; /* Next slot to write, only written by the emulator */
+   unsigned int tail; /* Next slot to read, only written by the writer */
+   int format; /* RECORD_Y4M or RECORD_PNG */
+   const char *path; /* Y4M file, or PNG file name prefix */
+   FILE *file; /* Open Y4M file */
+   unsigned char *line; /* Scratch scanline for the encoder */
+   int quit; /* Set to drain the queue and stop */
+   int failed; /* Writer hit an I/O error and gave up */
+   unsigned long written; /* Frames encoded */
+   unsigned long dropped; /* Frames lost to a full queue */
+   SDL_sem *ready; /* Posted once per queued frame */
+   SDL_Thread *thread;
+} Recorder;
+
+int StartRecorder(Recorder * rec, const char * path, int format, unsigned int depth);
+void RecordFrame(Recorder * rec, Frame * frame);
+void StopRecorder(Recorder * rec);
+
+#endif
@@ -0,0 +1,434 @@
+/*
+   * @file   difffuzz.c
+   * @brief  Differential fuzzer between interpreter engines
+   *
+   * Generates random CHIP-8 programs (or mutates the ROMs given
+   * on the command line), runs each in lockstep on the reference
+   * EmulateCycle and on a faster engine, and compares the whole
+   * machine state after every instruction. A diverging program is
+   * shrunk to the shortest one that still diverges and reported.
+   *
+   * Every program runs under a random quirk profile, which also
+   * checks each stamped engine against the profile table.
+   *
+   * Instances are reset in memory from a booted copy, so there is
+   * no process restart and no SDL. One worker per core.
+   *
+   * Usage: difffuzz [--seconds N] [--jobs N] [--seed N] [--steps N]
+   *                 [--engine name] [--save dir] [seed.ch8 ...]
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "engine.h"
+
+#define MAX_PROGRAM 256 /* Bytes. Generated programs are shorter */
+#define MAX_REPORTS 10 /* Failures printed in full, the rest are only counted */
+
+typedef struct {
+   const char *name;
+   int (*step)(Chip8 * chip8);
+} Engine;
+
+static const Engine engines[] =
+{
+   { "table", EmulateCycleTable },
+};
+
+#define NENGINES (sizeof(engines) / sizeof(engines[0]))
+
+typedef struct {
+   unsigned char data[MAX_PROGRAM];
+   int len;
+   int profile; /* Quirk profile both engines run it under */
+} Program;
+
+typedef struct {
+   long step; /* Instruction the states first differed after, -1 if never */
+   unsigned short pc; /* pc before that instruction */
+   unsigned short opcode;
+   const char *field; /* First field that differed */
+   int errref, errengine;
+} Divergence;
+
+typedef struct {
+   int id;
+   uint64_t rng;
+   unsigned long programs;
+   unsigned long failures;
+} Worker;
+
+static Chip8 boot; /* Freshly initialised machine every run starts from */
+static Program *seeds;
+static int nseeds;
+static const Engine *engine;
+static long maxsteps = 2000;
+static int stop;
+static const char *savedir;
+static unsigned long reported;
+static pthread_mutex_t reportlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Mostly well formed instructions, so runs get past the first few words */
+static unsigned short RandomOpcode(uint64_t * rng, int len)
+{
+   static const unsigned char fops[] = { 0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x30, 0x33, 0x55, 0x65, 0x75, 0x85 };
+   static const unsigned short zeros[] = { 0x00E0, 0x00EE, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF };
+   static const unsigned char eighths[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+   uint64_t r = Random64(rng);
+   unsigned short top = (r >> 8) & 0xF;
+   unsigned short xy = (r >> 16) & 0x0FF0;
+   unsigned short target = 0x200 + 2 * ((r >> 32) % (len / 2 > 0 ? len / 2 : 1));
+
+   if ((r & 7) == 0) return r >> 40;
+
+   switch(top)
+   {
+      case 0x0:
+         if ((r >> 24) & 1) return 0x00C0 | ((r >> 28) & 0xF);
+         return zeros[(r >> 32) % (sizeof(zeros) / sizeof(zeros[0]))];
+      case 0x1:
+      case 0x2:
+      case 0xB:
+         return (top << 12) | (target & 0x0FFF);
+      case 0x5:
+      case 0x9:
+         return (top << 12) | xy;
+      case 0x8:
+         return 0x8000 | xy | eighths[(r >> 40) % sizeof(eighths)];
+      case 0xE:
+         return 0xE000 | (xy & 0x0F00) | ((r >> 40) & 1 ? 0x9E : 0xA1);
+      case 0xF:
+         return 0xF000 | (xy & 0x0F00) | fops[(r >> 40) % sizeof(fops)];
+      default:
+         return (top << 12) | ((r >> 24) & 0x0FFF);
+   }
+}
+
+static void Generate(Worker * w, Program * p)
+{
+   Program *seed;
+   unsigned short op;
+   int i, n, at;
+
+   if (nseeds > 0 && (Random64(&w->rng) & 1))
+   {
+      /* Mutate a seed ROM */
+      seed = &seeds[Random64(&w->rng) % nseeds];
+      *p = *seed;
+      p->profile = Random64(&w->rng) % NPROFILES;
+      n = 1 + Random64(&w->rng) % 8;
+      for (i = 0; i < n; i++)
+      {
+         at = (Random64(&w->rng) % (p->len / 2)) * 2;
+         switch(Random64(&w->rng) % 3)
+         {
+            case 0:
+               p->data[at + (Random64(&w->rng) & 1)] ^= 1 << (Random64(&w->rng) % 8);
+            break;
+
+            case 1:
+               p->data[at] = Random64(&w->rng);
+            break;
+
+            default:
+               op = RandomOpcode(&w->rng, p->len);
+               p->data[at] = op >> 8;
+               p->data[at + 1] = op & 0xFF;
+            break;
+         }
+      }
+      return;
+   }
+
+   p->profile = Random64(&w->rng) % NPROFILES;
+   p->len = 2 * (1 + Random64(&w->rng) % (MAX_PROGRAM / 4));
+   for (i = 0; i < p->len; i += 2)
+   {
+      op = RandomOpcode(&w->rng, p->len);
+      p->data[i] = op >> 8;
+      p->data[i + 1] = op & 0xFF;
+   }
+}
+
+/* Name of the first field that differs, or NULL */
+static const char * Compare(Chip8 * a, Chip8 * b)
+{
+   if (a->pc != b->pc) return "pc";
+   if (a->opcode != b->opcode) return "opcode";
+   if (memcmp(a->V, b->V, sizeof(a->V)) != 0) return "V";
+   if (a->I != b->I) return "I";
+   if (a->sp != b->sp) return "sp";
+   if (memcmp(a->stack, b->stack, sizeof(a->stack)) != 0) return "stack";
+   if (a->delay_timer != b->delay_timer) return "delay_timer";
+   if (a->sound_timer != b->sound_timer) return "sound_timer";
+   if (a->DrawFlag != b->DrawFlag) return "DrawFlag";
+   if (a->hires != b->hires) return "hires";
+   if (a->profile != b->profile) return "profile";
+   if (memcmp(a->rpl, b->rpl, sizeof(a->rpl)) != 0) return "rpl";
+   if (memcmp(a->gfx, b->gfx, sizeof(a->gfx)) != 0) return "gfx";
+   if (memcmp(a->memory, b->memory, sizeof(a->memory)) != 0) return "memory";
+
+   return NULL;
+}
+
+static int Run(Program * p, unsigned int keys, Divergence * d)
+{
+   static __thread Chip8 ref, fast;
+   long step;
+   int i;
+
+   ref = boot;
+   ref.profile = p->profile;
+   memcpy(&ref.memory[0x200], p->data, p->len);
+   for (i = 0; i < 16; i++)
+   {
+      ref.key[i] = (keys >> i) & 1;
+   }
+   fast = ref;
+
+   d->step = -1;
+   for (step = 0; step < maxsteps; step++)
+   {
+      d->pc = ref.pc;
+      d->errref = EmulateCycle(&ref);
+      d->errengine = engine->step(&fast);
+      d->opcode = ref.opcode;
+
+      if (d->errref != d->errengine)
+      {
+         d->field = "return code";
+      } else {
+         d->field = Compare(&ref, &fast);
+      }
+
+      if (d->field != NULL)
+      {
+         d->step = step;
+         return 1;
+      }
+
+      /* Both stopped the same way */
+      if (d->errref != 0) return 0;
+
+      if ((step + 1) % CYCLES_PER_FRAME == 0)
+      {
+         DecrementTimers(&ref);
+         DecrementTimers(&fast);
+      }
+   }
+
+   return 0;
+}
+
+/* Delete ever smaller runs of instructions while the program still diverges */
+static void Minimise(Program * p, unsigned int * keys, Divergence * d)
+{
+   Program trial;
+   Divergence td;
+   int chunk, start;
+
+   trial.profile = p->profile;
+
+   if (Run(p, 0, &td))
+   {
+      *keys = 0;
+      *d = td;
+   }
+
+   /* Nothing past the diverging instruction is needed unless it jumps back */
+   trial.len = d->pc - 0x200 + 2;
+   if (d->pc >= 0x200 && trial.len < p->len)
+   {
+      memcpy(trial.data, p->data, trial.len);
+      if (Run(&trial, *keys, &td))
+      {
+         *p = trial;
+         *d = td;
+      }
+   }
+
+   for (chunk = (p->len / 2) & ~1; chunk >= 2; )
+   {
+      for (start = 0; start + chunk <= p->len && p->len > 2; )
+      {
+         trial.len = p->len - chunk;
+         memcpy(trial.data, p->data, start);
+         memcpy(trial.data + start, p->data + start + chunk, p->len - start - chunk);
+
+         if (Run(&trial, *keys, &td))
+         {
+            *p = trial;
+            *d = td;
+         } else {
+            start += chunk;
+         }
+      }
+
+      chunk = (chunk / 2) & ~1;
+   }
+}
+
+static void Report(Worker * w, Program * p, unsigned int keys, Divergence * d)
+{
+   char path[4096];
+   uint64_t hash;
+   FILE *file;
+   int i;
+
+   pthread_mutex_lock(&reportlock);
+
+   if (reported++ < MAX_REPORTS)
+   {
+      printf("DIVERGE %s: profile %s, step %ld pc %x opcode %04x, %s differs (return %d vs %d), keys %04x, %d bytes:",
+         engine->name, quirk_profiles[p->profile].name, d->step, d->pc, d->opcode, d->field, d->errref, d->errengine, keys, p->len);
+      for (i = 0; i < p->len; i += 2)
+      {
+         printf(" %02x%02x", p->data[i], p->data[i + 1]);
+      }
+      printf("\n");
+
+      if (savedir != NULL)
+      {
+         hash = Hash64(p->data, p->len, keys);
+         snprintf(path, sizeof(path), "%s/diff-%016" PRIx64 ".ch8", savedir, hash);
+         if ((file = fopen(path, "wb")) != NULL)
+         {
+            fwrite(p->data, 1, p->len, file);
+            fclose(file);
+         }
+      }
+   }
+
+   pthread_mutex_unlock(&reportlock);
+}
+
+static void * WorkerThread(void * arg)
+{
+   Worker *w = arg;
+   Program p;
+   Divergence d;
+   unsigned int keys;
+
+   while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+   {
+      Generate(w, &p);
+      keys = Random64(&w->rng) & Random64(&w->rng) & 0xFFFF;
+
+      if (Run(&p, keys, &d))
+      {
+         Minimise(&p, &keys, &d);
+         Report(w, &p, keys, &d);
+         w->failures++;
+      }
+      w->programs++;
+   }
+
+   return NULL;
+}
+
+static int ReadSeed(Program * p, const char * path)
+{
+   FILE *file;
+
+   if ((file = fopen(path, "rb")) == NULL) return 1;
+   p->len = fread(p->data, 1, MAX_PROGRAM, file) & ~1;
+   fclose(file);
+
+   return p->len == 0;
+}
+
+int main(int argc, char **argv)
+{
+   pthread_t *threads;
+   Worker *workers;
+   struct timespec t0, t1;
+   unsigned long programs = 0, failures = 0;
+   uint64_t seed = time(NULL);
+   double elapsed;
+   int seconds = 10;
+   int nthreads = 0;
+   unsigned int i, e;
+
+   engine = &engines[0];
+   seeds = calloc(argc, sizeof(Program));
+
+   for (i = 1; i < (unsigned int) argc; i++)
+   {
+      if (strcmp(argv[i], "--seconds") == 0 && i+1 < (unsigned int) argc)
+      {
+         seconds = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--jobs") == 0 && i+1 < (unsigned int) argc) {
+         nthreads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--seed") == 0 && i+1 < (unsigned int) argc) {
+         seed = strtoull(argv[++i], NULL, 0);
+      } else if (strcmp(argv[i], "--steps") == 0 && i+1 < (unsigned int) argc) {
+         maxsteps = atol(argv[++i]);
+      } else if (strcmp(argv[i], "--save") == 0 && i+1 < (unsigned int) argc) {
+         savedir = argv[++i];
+      } else if (strcmp(argv[i], "--engine") == 0 && i+1 < (unsigned int) argc) {
+         i++;
+         engine = NULL;
+         for (e = 0; e < NENGINES; e++)
+         {
+            if (strcmp(argv[i], engines[e].name) == 0) engine = &engines[e];
+         }
+         if (engine == NULL)
+         {
+            printf("Unknown engine %s\n", argv[i]);
+            return 4;
+         }
+      } else if (ReadSeed(&seeds[nseeds], argv[i]) == 0) {
+         nseeds++;
+      } else {
+         printf("Cannot read seed ROM %s\n", argv[i]);
+         return 2;
+      }
+   }
+
+   InitCPU(&boot);
+
+   if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads <= 0) nthreads = 1;
+
+   printf("Fuzzing reference against %s on %d threads for %d seconds, seed %" PRIu64 "\n", engine->name, nthreads, seconds, seed);
+
+   threads = malloc(nthreads * sizeof(pthread_t));
+   workers = calloc(nthreads, sizeof(Worker));
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+
+   for (i = 0; i < (unsigned int) nthreads; i++)
+   {
+      workers[i].id = i;
+      workers[i].rng = (seed + i) * 0x9E3779B97F4A7C15ULL | 1;
+      pthread_create(&threads[i], NULL, WorkerThread, &workers[i]);
+   }
+
+   sleep(seconds);
+   __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+   for (i = 0; i < (unsigned int) nthreads; i++)
+   {
+      pthread_join(threads[i], NULL);
+      programs += workers[i].programs;
+      failures += workers[i].failures;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+   printf("%lu programs, %lu diverged, %.0f programs/hour\n", programs, failures, programs / elapsed * 3600);
+
+   free(threads);
+   free(workers);
+   free(seeds);
+
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,423 @@
+/*
+   * @file   regress.c
+   * @brief  Golden hash regression suite over a ROM corpus
+   *
+   * Runs every ROM headless with its recorded input script and
+   * hashes the screen and CPU state (V, I, pc, sp) at the frames
+   * listed in its golden file. The first frame whose hash differs
+   * from the golden one is reported. ROMs run in parallel.
+   *
+   * --pack runs every ROM in a corpus pack as well, with input
+   * scripts taken from the pack's directory.
+   *
+   * Usage: regress [--update] [--jobs N] [--golden dir] [--pack file] [rom.ch8 ...]
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "engine.h"
+#include "pack.h"
+
+#define MAX_CHECKPOINTS 1024
+#define MAX_KEYS 1024
+
+/* Default schedule when a golden file is first written */
+#define DEFAULT_FRAMES 600
+#define DEFAULT_EVERY 10
+
+typedef struct {
+   unsigned long frame[MAX_KEYS]; /* Frame the mask takes effect on */
+   unsigned int mask[MAX_KEYS]; /* Keypad bitmask */
+   int count;
+} Script;
+
+typedef struct {
+   int cycles; /* Instructions per frame */
+   int profile; /* Quirk profile */
+   unsigned long frame[MAX_CHECKPOINTS];
+   uint64_t hash[MAX_CHECKPOINTS];
+   int count;
+} Golden;
+
+typedef struct {
+   const char *name;
+   int (*frame)(Chip8 * chip8, int cycles);
+} Engine;
+
+/* Every engine must match the same goldens. --update only uses the first */
+static const Engine engines[] =
+{
+   { "reference", EmulateFrame },
+   { "table", EmulateFrameTable },
+};
+
+#define NENGINES (sizeof(engines) / sizeof(engines[0]))
+
+typedef struct {
+   const char *rom;
+   const PackEntry *entry; /* Packed ROM, or NULL to load rom from disk */
+   const Engine *engine;
+   char name[256]; /* ROM file name without directory or extension */
+   int failed;
+   char message[512];
+} Job;
+
+static Job *jobs;
+static int njobs;
+static int nextjob;
+static int update;
+static const char *goldendir = "tests/golden";
+static Pack pack;
+static const char *packpath;
+
+/* Path of a file next to the ROM with another extension */
+static void SiblingPath(char * out, size_t len, const char * rom, const char * ext)
+{
+   const char *dot = strrchr(rom, '.');
+   const char *slash = strrchr(rom, '/');
+   int stem = (dot != NULL && (slash == NULL || dot > slash)) ? (int) (dot - rom) : (int) strlen(rom);
+
+   snprintf(out, len, "%.*s%s", stem, rom, ext);
+}
+
+/* Missing script means no keys are ever pressed */
+static int ReadScript(Script * script, const char * path)
+{
+   FILE *file;
+   char line[256];
+
+   script->count = 0;
+   if ((file = fopen(path, "r")) == NULL) return 0;
+
+   while (fgets(line, sizeof(line), file) != NULL && script->count < MAX_KEYS)
+   {
+      if (line[0] == '#' || line[0] == '\n') continue;
+      if (sscanf(line, "%lu %x", &script->frame[script->count], &script->mask[script->count]) == 2)
+      {
+         script->count++;
+      }
+   }
+   fclose(file);
+
+   return 0;
+}
+
+/*
+   Returns 0, 1 if the file can't be opened, 2 on an unknown profile,
+   or 3 if the frames aren't strictly ascending from 1
+*/
+static int ReadGolden(Golden * golden, const char * path)
+{
+   FILE *file;
+   char line[256];
+   char name[64];
+
+   golden->cycles = CYCLES_PER_FRAME;
+   golden->profile = PROFILE_DEFAULT;
+   golden->count = 0;
+   if ((file = fopen(path, "r")) == NULL) return 1;
+
+   while (fgets(line, sizeof(line), file) != NULL && golden->count < MAX_CHECKPOINTS)
+   {
+      if (line[0] == '#' || line[0] == '\n') continue;
+      if (sscanf(line, "cycles %d", &golden->cycles) == 1) continue;
+      if (sscanf(line, "profile %63s", name) == 1)
+      {
+         if ((golden->profile = ProfileByName(name)) < 0)
+         {
+            fclose(file);
+            return 2;
+         }
+         continue;
+      }
+      if (sscanf(line, "%lu %" SCNx64, &golden->frame[golden->count], &golden->hash[golden->count]) == 2)
+      {
+         /* The first failing checkpoint is reported as the first divergence */
+         if (golden->frame[golden->count] <= (golden->count > 0 ? golden->frame[golden->count - 1] : 0))
+         {
+            fclose(file);
+            return 3;
+         }
+         golden->count++;
+      }
+   }
+   fclose(file);
+
+   return 0;
+}
+
+static int WriteGolden(Golden * golden, const char * path, const char * name)
+{
+   FILE *file;
+   int i;
+
+   if ((file = fopen(path, "w")) == NULL) return 1;
+
+   fprintf(file, "# %s: frame, hash of screen + V, I, pc, sp after that frame\n", name);
+   fprintf(file, "cycles %d\n", golden->cycles);
+   fprintf(file, "profile %s\n", quirk_profiles[golden->profile].name);
+   for (i = 0; i < golden->count; i++)
+   {
+      fprintf(file, "%lu %016" PRIx64 "\n", golden->frame[i], golden->hash[i]);
+   }
+
+   return fclose(file) != 0;
+}
+
+static uint64_t HashState(Chip8 * chip8)
+{
+   uint64_t lores[32];
+   unsigned char cpu[22];
+   uint64_t h;
+   int y;
+
+   /* Low resolution hashes only the 64x32 it uses, so goldens don't depend on the layout */
+   if (chip8->hires)
+   {
+      h = Hash64(chip8->gfx, sizeof(chip8->gfx), 0);
+   } else {
+      for (y = 0; y < 32; y++)
+      {
+         lores[y] = chip8->gfx[y][0];
+      }
+      h = Hash64(lores, sizeof(lores), 0);
+   }
+
+   memcpy(cpu, chip8->V, 16);
+   cpu[16] = chip8->I & 0xFF;
+   cpu[17] = chip8->I >> 8;
+   cpu[18] = chip8->pc & 0xFF;
+   cpu[19] = chip8->pc >> 8;
+   cpu[20] = chip8->sp & 0xFF;
+   cpu[21] = chip8->sp >> 8;
+
+   return Hash64(cpu, sizeof(cpu), h);
+}
+
+static void RunJob(Job * job)
+{
+   Chip8 chip8;
+   Script script;
+   Golden golden;
+   char path[4096];
+   char goldenpath[4096];
+   unsigned long frame, last;
+   unsigned int mask = 0;
+   const char *slash;
+   uint64_t hash;
+   int i, k = 0, check = 0, err;
+
+   snprintf(goldenpath, sizeof(goldenpath), "%s/%s.golden", goldendir, job->name);
+   err = ReadGolden(&golden, goldenpath);
+
+   /* --update rewrites a missing golden but never one it can't parse */
+   if (err >= 2)
+   {
+      job->failed = 1;
+      snprintf(job->message, sizeof(job->message), "%.400s: %s", goldenpath,
+         err == 2 ? "unknown profile" : "frames not in ascending order");
+      return;
+   }
+   if (err != 0 || golden.count == 0)
+   {
+      if (!update)
+      {
+         job->failed = 1;
+         snprintf(job->message, sizeof(job->message), "cannot read %.400s", goldenpath);
+         return;
+      }
+
+      for (i = 0; i < DEFAULT_FRAMES / DEFAULT_EVERY; i++)
+      {
+         golden.frame[i] = (i + 1) * DEFAULT_EVERY;
+      }
+      golden.count = DEFAULT_FRAMES / DEFAULT_EVERY;
+
+      /* A new golden starts from what the pack recorded */
+      if (job->entry != NULL && job->entry->cycles > 0) golden.cycles = job->entry->cycles;
+      if (job->entry != NULL && job->entry->profile >= 0) golden.profile = job->entry->profile;
+   }
+
+   if (job->entry != NULL)
+   {
+      slash = strrchr(packpath, '/');
+      snprintf(path, sizeof(path), "%.*s%s.keys", slash ? (int) (slash - packpath) + 1 : 0, packpath, job->entry->name);
+   } else {
+      SiblingPath(path, sizeof(path), job->rom, ".keys");
+   }
+   ReadScript(&script, path);
+
+   /* The golden's profile wins over the one in the pack */
+   InitCPU(&chip8);
+   if (job->entry != NULL)
+   {
+      LoadPacked(&chip8, &pack, job->entry);
+   } else if (LoadFile(job->rom, &chip8) != 0) {
+      job->failed = 1;
+      snprintf(job->message, sizeof(job->message), "cannot load %.400s", job->rom);
+      return;
+   }
+   chip8.profile = golden.profile;
+
+   last = golden.frame[golden.count - 1];
+   for (frame = 1; frame <= last; frame++)
+   {
+      while (k < script.count && script.frame[k] < frame)
+      {
+         mask = script.mask[k++];
+      }
+      for (i = 0; i < 16; i++)
+      {
+         chip8.key[i] = (mask >> i) & 1;
+      }
+
+      if ((err = job->engine->frame(&chip8, golden.cycles)) != 0)
+      {
+         job->failed = 1;
+         snprintf(job->message, sizeof(job->message), "error %d at frame %lu, pc %x opcode %x", err, frame, chip8.pc, chip8.opcode);
+         return;
+      }
+
+      if (frame != golden.frame[check]) continue;
+
+      hash = HashState(&chip8);
+      if (update)
+      {
+         golden.hash[check] = hash;
+      } else if (hash != golden.hash[check]) {
+         job->failed = 1;
+         snprintf(job->message, sizeof(job->message), "first diverging frame %lu (last match %lu): expected %016" PRIx64 " got %016" PRIx64,
+            frame, check > 0 ? golden.frame[check - 1] : 0, golden.hash[check], hash);
+         return;
+      }
+      check++;
+   }
+
+   if (update && WriteGolden(&golden, goldenpath, job->name) != 0)
+   {
+      job->failed = 1;
+      snprintf(job->message, sizeof(job->message), "cannot write %.400s", goldenpath);
+      return;
+   }
+
+   snprintf(job->message, sizeof(job->message), "%d frames checked", golden.count);
+}
+
+static void * Worker(void * arg)
+{
+   int i;
+
+   (void) arg;
+   while ((i = __atomic_fetch_add(&nextjob, 1, __ATOMIC_RELAXED)) < njobs)
+   {
+      RunJob(&jobs[i]);
+   }
+
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   pthread_t *threads;
+   const char *base;
+   int nthreads = 0;
+   int failed = 0;
+   int i;
+   unsigned int e, k;
+
+   jobs = calloc(argc * NENGINES, sizeof(Job));
+   if (jobs == NULL) return 1;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--update") == 0)
+      {
+         update = 1;
+      } else if (strcmp(argv[i], "--jobs") == 0 && i+1 < argc) {
+         nthreads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--golden") == 0 && i+1 < argc) {
+         goldendir = argv[++i];
+      } else if (strcmp(argv[i], "--pack") == 0 && i+1 < argc && packpath == NULL) {
+         packpath = argv[++i];
+         if (OpenPack(&pack, packpath) != 0)
+         {
+            printf("Cannot open pack %s\n", packpath);
+            return 2;
+         }
+         if ((jobs = realloc(jobs, (argc + pack.count) * NENGINES * sizeof(Job))) == NULL) return 1;
+         memset(&jobs[njobs], 0, ((argc + pack.count) * NENGINES - njobs) * sizeof(Job));
+         for (k = 0; k < pack.count; k++)
+         {
+            for (e = 0; e < NENGINES; e++)
+            {
+               jobs[njobs].rom = pack.entries[k].name;
+               jobs[njobs].entry = &pack.entries[k];
+               jobs[njobs].engine = &engines[e];
+               snprintf(jobs[njobs].name, sizeof(jobs[njobs].name), "%s", pack.entries[k].name);
+               njobs++;
+            }
+         }
+      } else {
+         base = strrchr(argv[i], '/');
+         base = base ? base + 1 : argv[i];
+         for (e = 0; e < NENGINES; e++)
+         {
+            jobs[njobs].rom = argv[i];
+            jobs[njobs].engine = &engines[e];
+            SiblingPath(jobs[njobs].name, sizeof(jobs[njobs].name), base, "");
+            njobs++;
+         }
+      }
+   }
+
+   /* Goldens are written from the reference engine alone */
+   if (update)
+   {
+      for (i = 0; i < njobs / (int) NENGINES; i++)
+      {
+         jobs[i] = jobs[i * NENGINES];
+      }
+      njobs = njobs / NENGINES;
+   }
+
+   if (njobs == 0)
+   {
+      printf("Usage: regress [--update] [--jobs N] [--golden dir] [--pack file] [rom.ch8 ...]\n");
+      return 4;
+   }
+
+   if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads <= 0) nthreads = 1;
+   if (nthreads > njobs) nthreads = njobs;
+
+   threads = malloc(nthreads * sizeof(pthread_t));
+   for (i = 0; i < nthreads; i++)
+   {
+      pthread_create(&threads[i], NULL, Worker, NULL);
+   }
+   for (i = 0; i < nthreads; i++)
+   {
+      pthread_join(threads[i], NULL);
+   }
+
+   for (i = 0; i < njobs; i++)
+   {
+      printf("%s %s [%s]: %s\n", jobs[i].failed ? "FAIL" : (update ? "UPDATED" : "PASS"), jobs[i].name, jobs[i].engine->name, jobs[i].message);
+      failed += jobs[i].failed;
+   }
+
+   printf("%d of %d runs passed\n", njobs - failed, njobs);
+
+   free(threads);
+   free(jobs);
+   ClosePack(&pack);
+
+   return failed ? 1 : 0;
+}
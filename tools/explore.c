@@ -0,0 +1,490 @@
+/*
+   * @file   explore.c
+   * @brief  Parallel state-space explorer
+   *
+   * Starting from a booted ROM, tries every keypad input on every
+   * state, one frame at a time, breadth first. New states are
+   * found by hashing the whole machine into a lock-free hash set
+   * shared by all threads, so each state is expanded once.
+   *
+   * Reports runs that crash (bad opcode, stack fault), exit, halt
+   * (jump to itself), or soft-lock (no input changes anything),
+   * and stops at the first state matching every --goal, boot
+   * included. Each is printed as a keys script
+   * tests/regress can replay.
+   *
+   * With --beam, only the best states by --score (then by hash,
+   * so runs are repeatable) are kept at each depth.
+   *
+   * Usage: explore [--frames N] [--beam N] [--jobs N] [--cycles N]
+   *                [--profile name] [--pack file] [--keys mask] [--max-states N]
+   *                [--goal expr] ... [--score operand] rom.ch8
+   *
+   * Operands are mem[ADDR], V0 .. VF, I, pc, sp, dt and st. A goal
+   * is an operand, one of == != < <= > >=, and a number.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "engine.h"
+#include "pack.h"
+#include "predicate.h"
+
+#define MAX_GOALS 16
+#define MAX_REPORTS 5 /* Of each kind, the rest are only counted */
+#define NO_PARENT 0xFFFFFFFFu
+
+enum { FOUND_GOAL, FOUND_CRASH, FOUND_EXIT, FOUND_HALT, FOUND_STUCK, NFOUND };
+
+static const char *foundnames[NFOUND] = { "GOAL", "CRASH", "EXIT", "HALT", "STUCK" };
+
+/* How a state was reached. One per state kept, so paths can be printed */
+typedef struct {
+   unsigned int parent; /* Trace of the state before, NO_PARENT for boot */
+   unsigned short keys; /* Keypad mask held for the frame */
+} Trace;
+
+typedef struct {
+   Chip8 state;
+   uint64_t hash;
+   long score;
+   unsigned int trace; /* This state's trace, or its parent's until it is kept */
+   unsigned short keys; /* Input that led here from the parent */
+} Node;
+
+/* Open addressing on 64-bit state hashes. 0 marks an empty slot */
+typedef struct {
+   uint64_t *slot;
+   uint64_t mask;
+   unsigned long count;
+   unsigned long limit;
+} HashSet;
+
+typedef struct {
+   unsigned long frames;
+} Worker;
+
+static HashSet seen;
+static Node *current, *next;
+static unsigned long ncurrent, nnext, nextcap;
+static unsigned long nextnode;
+static Trace *traces;
+static unsigned long ntraces, tracecap;
+static unsigned short inputs[17];
+static int ninputs;
+static int cycles;
+static int depth; /* Frames run to reach the current frontier */
+static Predicate goals[MAX_GOALS];
+static int ngoals;
+static Operand score;
+static int scored;
+static int stop;
+static int full;
+static unsigned long dropped;
+static unsigned long found[NFOUND];
+static pthread_mutex_t reportlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 1 if new, 0 if already there, -1 once the set holds limit states */
+static int SetInsert(HashSet * set, uint64_t hash)
+{
+   uint64_t i, expected;
+
+   if (hash == 0) hash = 1;
+
+   for (i = hash & set->mask; ; i = (i + 1) & set->mask)
+   {
+      expected = __atomic_load_n(&set->slot[i], __ATOMIC_RELAXED);
+      if (expected == hash) return 0;
+      if (expected != 0) continue;
+
+      if (__atomic_compare_exchange_n(&set->slot[i], &expected, hash, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+         return __atomic_add_fetch(&set->count, 1, __ATOMIC_RELAXED) > set->limit ? -1 : 1;
+      }
+
+      /* Lost the race. Same state, or keep probing */
+      if (expected == hash) return 0;
+   }
+}
+
+/*
+   Print the inputs from boot as a keys script, one line per change
+   of mask. last, if not NULL, is one more frame after trace
+*/
+static void PrintPath(unsigned int trace, const unsigned short * last)
+{
+   unsigned short *masks;
+   unsigned int t;
+   int n = 0, frame;
+   unsigned short held = 0;
+
+   masks = malloc((depth + 1) * sizeof(unsigned short));
+   if (masks == NULL) return;
+
+   if (last != NULL) masks[n++] = *last;
+   for (t = trace; t != NO_PARENT && traces[t].parent != NO_PARENT; t = traces[t].parent)
+   {
+      masks[n++] = traces[t].keys;
+   }
+
+   /* masks is newest first. The mask for frame f takes effect once f-1 frames have run */
+   for (frame = 0; frame < n; frame++)
+   {
+      if (masks[n - 1 - frame] != held)
+      {
+         held = masks[n - 1 - frame];
+         printf("%d %x\n", frame, held);
+      }
+   }
+
+   free(masks);
+}
+
+/* keys is the input for one more frame after node, or NULL if the finding is node itself */
+static void Report(int kind, Node * node, const unsigned short * keys, Chip8 * after, int err)
+{
+   int i;
+
+   pthread_mutex_lock(&reportlock);
+
+   if (found[kind]++ < MAX_REPORTS)
+   {
+      printf("# %s at frame %d", foundnames[kind], depth + (keys != NULL));
+      if (kind == FOUND_CRASH) printf(": error %d, pc %x opcode %04x", err, after->pc, after->opcode);
+      if (kind == FOUND_HALT) printf(": pc %x jumps to itself", node->state.pc);
+      if (kind == FOUND_STUCK) printf(": pc %x, no input changes the state", node->state.pc);
+      for (i = 0; kind == FOUND_GOAL && i < ngoals; i++)
+      {
+         printf("%s%s", i == 0 ? ": " : ", ", goals[i].text);
+      }
+      printf("\n");
+
+      PrintPath(node->trace, keys);
+   }
+
+   if (kind == FOUND_GOAL) __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+   pthread_mutex_unlock(&reportlock);
+}
+
+/* A jump to itself is how CHIP-8 programs halt, so it is not a soft-lock */
+static int Halted(Chip8 * chip8)
+{
+   int pc = chip8->pc & 0xFFF;
+
+   return ((chip8->memory[pc] << 8) | chip8->memory[(pc + 1) & 0xFFF]) == (0x1000 | pc);
+}
+
+static void * Expand(void * arg)
+{
+   Worker *w = arg;
+   Chip8 state;
+   Node *node, *child;
+   unsigned long i, slot;
+   uint64_t hash;
+   int k, j, err, stuck, r;
+
+   while (!__atomic_load_n(&stop, __ATOMIC_RELAXED) && (i = __atomic_fetch_add(&nextnode, 1, __ATOMIC_RELAXED)) < ncurrent)
+   {
+      node = &current[i];
+      stuck = 1;
+
+      for (k = 0; k < ninputs; k++)
+      {
+         state = node->state;
+         for (j = 0; j < 16; j++)
+         {
+            state.key[j] = (inputs[k] >> j) & 1;
+         }
+
+         err = EmulateFrameTable(&state, cycles);
+         w->frames++;
+
+         if (err != 0)
+         {
+            stuck = 0;
+            Report(err == ERR_EXIT ? FOUND_EXIT : FOUND_CRASH, node, &inputs[k], &state, err);
+            continue;
+         }
+
+         hash = StateHash(&state);
+         if (hash != node->hash) stuck = 0;
+
+         if ((r = SetInsert(&seen, hash)) == 0) continue;
+         if (r < 0)
+         {
+            __atomic_store_n(&full, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+            break;
+         }
+
+         if (ngoals > 0 && AllHold(&state, goals, ngoals))
+         {
+            Report(FOUND_GOAL, node, &inputs[k], &state, 0);
+            break;
+         }
+
+         if ((slot = __atomic_fetch_add(&nnext, 1, __ATOMIC_RELAXED)) >= nextcap)
+         {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            continue;
+         }
+
+         child = &next[slot];
+         child->state = state;
+         child->hash = hash;
+         child->score = scored ? OperandValue(&state, &score) : 0;
+         child->trace = node->trace;
+         child->keys = inputs[k];
+      }
+
+      if (stuck) Report(Halted(&node->state) ? FOUND_HALT : FOUND_STUCK, node, NULL, &node->state, 0);
+   }
+
+   return NULL;
+}
+
+/* Highest score first, then by hash so the beam doesn't depend on thread timing */
+static int ByScore(const void * a, const void * b)
+{
+   const Node *x = *(Node * const *) a;
+   const Node *y = *(Node * const *) b;
+
+   if (x->score != y->score) return x->score > y->score ? -1 : 1;
+   if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+
+   return 0;
+}
+
+/* Move the best beam states of next into current, giving each a trace */
+static int Select(unsigned long beam)
+{
+   Node **order;
+   unsigned long i, n = nnext < nextcap ? nnext : nextcap;
+
+   if ((order = malloc((n + 1) * sizeof(Node *))) == NULL) return 1;
+   for (i = 0; i < n; i++)
+   {
+      order[i] = &next[i];
+   }
+   if (n > beam)
+   {
+      dropped += n - beam;
+      qsort(order, n, sizeof(Node *), ByScore);
+      n = beam;
+   }
+
+   if (ntraces + n > tracecap)
+   {
+      tracecap = (ntraces + n) * 2;
+      if ((traces = realloc(traces, tracecap * sizeof(Trace))) == NULL)
+      {
+         free(order);
+         return 1;
+      }
+   }
+
+   for (i = 0; i < n; i++)
+   {
+      current[i] = *order[i];
+      traces[ntraces].parent = current[i].trace;
+      traces[ntraces].keys = current[i].keys;
+      current[i].trace = ntraces++;
+   }
+   ncurrent = n;
+
+   free(order);
+
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   pthread_t *threads;
+   Worker *workers;
+   struct timespec t0, t1;
+   const char *rom = NULL;
+   const char *packpath = NULL;
+   const char *s;
+   unsigned long beam = 1024;
+   unsigned long maxstates = 1UL << 22;
+   unsigned long frames = 0;
+   unsigned long capacity;
+   unsigned int keymask = 0xFFFF;
+   double elapsed;
+   int maxdepth = 600;
+   int nthreads = 0;
+   int profile = -1;
+   int i, k;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--frames") == 0 && i+1 < argc)
+      {
+         maxdepth = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--beam") == 0 && i+1 < argc) {
+         beam = strtoul(argv[++i], NULL, 0);
+      } else if (strcmp(argv[i], "--jobs") == 0 && i+1 < argc) {
+         nthreads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--cycles") == 0 && i+1 < argc) {
+         cycles = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc) {
+         if ((profile = ProfileByName(argv[++i])) < 0)
+         {
+            printf("Unknown profile %s\n", argv[i]);
+            return 4;
+         }
+      } else if (strcmp(argv[i], "--keys") == 0 && i+1 < argc) {
+         keymask = strtoul(argv[++i], NULL, 16) & 0xFFFF;
+      } else if (strcmp(argv[i], "--max-states") == 0 && i+1 < argc) {
+         maxstates = strtoul(argv[++i], NULL, 0);
+      } else if (strcmp(argv[i], "--goal") == 0 && i+1 < argc && ngoals < MAX_GOALS) {
+         if (ParsePredicate(&goals[ngoals], argv[++i]) != 0)
+         {
+            printf("Bad goal %s\n", argv[i]);
+            return 4;
+         }
+         ngoals++;
+      } else if (strcmp(argv[i], "--score") == 0 && i+1 < argc) {
+         s = argv[++i];
+         if (ParseOperand(&score, &s) != 0 || *s != '\0')
+         {
+            printf("Bad score operand %s\n", argv[i]);
+            return 4;
+         }
+         scored = 1;
+      } else if (strcmp(argv[i], "--pack") == 0 && i+1 < argc) {
+         packpath = argv[++i];
+      } else if (rom == NULL) {
+         rom = argv[i];
+      } else {
+         rom = NULL;
+         break;
+      }
+   }
+
+   if (rom == NULL || beam == 0 || maxstates == 0)
+   {
+      printf("Usage: explore [--frames N] [--beam N] [--jobs N] [--cycles N]\n");
+      printf("               [--profile name] [--pack file] [--keys mask] [--max-states N]\n");
+      printf("               [--goal expr] ... [--score operand] rom.ch8\n");
+      return 4;
+   }
+
+   /* No key, then each allowed key on its own */
+   inputs[ninputs++] = 0;
+   for (k = 0; k < 16; k++)
+   {
+      if (keymask & (1 << k)) inputs[ninputs++] = 1 << k;
+   }
+
+   /* Twice the limit keeps probe runs short */
+   for (capacity = 1; capacity < maxstates * 2; capacity <<= 1);
+   seen.slot = calloc(capacity, sizeof(uint64_t));
+   seen.mask = capacity - 1;
+   seen.limit = maxstates;
+
+   nextcap = beam * ninputs;
+   current = malloc(beam * sizeof(Node));
+   next = malloc(nextcap * sizeof(Node));
+   tracecap = beam * 4;
+   traces = malloc(tracecap * sizeof(Trace));
+   if (seen.slot == NULL || current == NULL || next == NULL || traces == NULL)
+   {
+      printf("Out of memory\n");
+      return 1;
+   }
+
+   InitCPU(&current[0].state);
+   if (LoadROM(&current[0].state, packpath, rom, &profile, &cycles) != 0)
+   {
+      printf("Cannot load %s\n", rom);
+      return 2;
+   }
+   if (cycles <= 0) cycles = CYCLES_PER_FRAME;
+   if (profile < 0) profile = LookupProfile(QUIRKS_DB, ProgramHash(&current[0].state));
+   if (profile >= 0) current[0].state.profile = profile;
+
+   current[0].hash = StateHash(&current[0].state);
+   current[0].trace = 0;
+   traces[0].parent = NO_PARENT;
+   traces[0].keys = 0;
+   ntraces = 1;
+   ncurrent = 1;
+   SetInsert(&seen, current[0].hash);
+
+   if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads <= 0) nthreads = 1;
+
+   printf("# Exploring %s, profile %s, %d inputs per frame, beam %lu, %d threads\n",
+      rom, quirk_profiles[current[0].state.profile].name, ninputs, beam, nthreads);
+
+   /* Expand only checks the states it reaches, so check boot here */
+   if (ngoals > 0 && AllHold(&current[0].state, goals, ngoals))
+   {
+      Report(FOUND_GOAL, &current[0], NULL, &current[0].state, 0);
+   }
+
+   threads = malloc(nthreads * sizeof(pthread_t));
+   workers = calloc(nthreads, sizeof(Worker));
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+
+   for (depth = 0; depth < maxdepth && ncurrent > 0 && !stop; depth++)
+   {
+      nextnode = 0;
+      nnext = 0;
+
+      for (i = 0; i < nthreads; i++)
+      {
+         pthread_create(&threads[i], NULL, Expand, &workers[i]);
+      }
+      for (i = 0; i < nthreads; i++)
+      {
+         pthread_join(threads[i], NULL);
+      }
+
+      if (stop) break;
+      if (Select(beam) != 0)
+      {
+         printf("Out of memory\n");
+         return 1;
+      }
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+   for (i = 0; i < nthreads; i++)
+   {
+      frames += workers[i].frames;
+   }
+
+   if (full)
+   {
+      printf("# Stopped at frame %d: --max-states %lu reached\n", depth, maxstates);
+   } else if (ncurrent == 0) {
+      printf("# Every reachable state explored by frame %d%s\n", depth, dropped ? ", but the beam dropped some" : "");
+   }
+
+   printf("# %lu unique states, %lu frames emulated, %.0f frames/s, %lu dropped by the beam\n",
+      seen.count, frames, frames / elapsed, dropped);
+   printf("# %lu goals, %lu crashes, %lu exits, %lu halts, %lu soft-locks\n",
+      found[FOUND_GOAL], found[FOUND_CRASH], found[FOUND_EXIT], found[FOUND_HALT], found[FOUND_STUCK]);
+
+   free(threads);
+   free(workers);
+   free(current);
+   free(next);
+   free(traces);
+   free(seen.slot);
+
+   return found[FOUND_CRASH] ? 1 : 0;
+}
@@ -0,0 +1,602 @@
+/*
+   * @file   keyfuzz.c
+   * @brief  Coverage guided keypad input fuzzer
+   *
+   * The ROM is fixed and the input is fuzzed: a keypad mask per
+   * frame. Each run counts the (previous pc, pc) edges it takes in
+   * a 64K byte map, AFL style, and a run that reaches an edge or
+   * hit count bucket nobody has seen joins the corpus.
+   *
+   * A corpus entry keeps a snapshot of the machine every
+   * SNAP_EVERY frames. A mutation only changes keys from one of
+   * those frames on, so the run starts there from the snapshot
+   * instead of from boot.
+   *
+   * Reports unknown opcodes, stack overflow and underflow,
+   * memory accesses past 0xFFF (which the emulator wraps), and
+   * hangs, where the CPU stays frozen while each key is pressed
+   * on its own.
+   * A jump to itself is how CHIP-8 programs halt, so it is not one.
+   * Each is printed once per kind and pc as a keys script that
+   * tests/regress can replay.
+   *
+   * Usage: keyfuzz [--seconds N] [--jobs N] [--seed N] [--frames N] [--cycles N]
+   *                [--profile name] [--pack file] [--keys mask] [--save dir] rom.ch8
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "engine.h"
+#include "pack.h"
+
+#define MAP_SIZE 65536 /* Edge counters, indexed by location ids */
+#define SNAP_EVERY 60 /* Frames between corpus snapshots */
+#define MAX_CORPUS 1024
+#define MAX_FINDINGS 256 /* Distinct kind and pc pairs */
+#define MAX_REPORTS 5 /* Of each kind printed in full, the rest go to --save */
+#define HANG_FRAMES 120 /* CPU frozen this long, while every key was pressed on its own, is a hang */
+
+enum { FOUND_NONE = -1, FOUND_OPCODE, FOUND_OVERFLOW, FOUND_UNDERFLOW, FOUND_MEMORY, FOUND_HANG, NFOUND };
+
+static const char *foundnames[NFOUND] = { "OPCODE", "OVERFLOW", "UNDERFLOW", "MEMORY", "HANG" };
+
+typedef struct {
+   unsigned short *keys; /* Mask per frame */
+   Chip8 *snaps; /* snaps[k] is the machine before frame k * SNAP_EVERY */
+   int nsnaps;
+} Entry;
+
+/* CPU state a hang is judged on. Cheap to compare every frame */
+typedef struct {
+   unsigned char V[16];
+   unsigned short I, pc, sp;
+   unsigned char delay_timer, sound_timer;
+} Registers;
+
+typedef struct {
+   uint64_t rng;
+   unsigned char trace[MAP_SIZE]; /* Hit counts of this run, zeroed as they are merged */
+   unsigned short *keys; /* Input being run */
+   Chip8 *snaps; /* Snapshots this run took, from its cut on */
+   int end; /* Last frame the run started */
+   unsigned short pc; /* Where a finding happened */
+   unsigned short opcode;
+   unsigned short I;
+   unsigned long execs;
+} Worker;
+
+static Chip8 boot;
+static uint16_t locations[4096]; /* Random id per address, so edges spread over the map */
+static unsigned char buckets[256]; /* Hit count to a single bit, 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ */
+static unsigned char virgin[MAP_SIZE]; /* Buckets seen by any run, shared */
+static Entry *corpus[MAX_CORPUS];
+static int ncorpus;
+static unsigned long edges;
+static int maxframes = 600;
+static int maxsnaps;
+static int cycles;
+static unsigned short keymask = 0xFFFF;
+static const char *savedir;
+static int stop;
+static struct { int kind; unsigned short pc; } findings[MAX_FINDINGS];
+static int nfindings;
+static unsigned long found[NFOUND];
+static pthread_mutex_t corpuslock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t reportlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Would the next instruction touch memory past 0xFFF? The engines wrap the address */
+static int OutOfRange(Chip8 * chip8)
+{
+   unsigned short opcode;
+   unsigned int rows, ycoord, height, last;
+
+   if (chip8->pc > 0xFFE) return 1;
+   opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
+
+   switch (opcode >> 12)
+   {
+      case 0xD:
+         /* Rows clipped at the bottom edge are never read */
+         rows = opcode & 0xF;
+         height = SCREEN_HEIGHT(chip8);
+         ycoord = chip8->V[(opcode >> 4) & 0xF] % height;
+         if (rows == 0)
+         {
+            rows = height - ycoord < 16 ? height - ycoord : 16;
+            last = 2 * rows - 1;
+         } else {
+            rows = height - ycoord < rows ? height - ycoord : rows;
+            last = rows - 1;
+         }
+         break;
+
+      case 0xF:
+         if ((opcode & 0xFF) == 0x33)
+         {
+            last = 2;
+         } else if ((opcode & 0xFF) == 0x55 || (opcode & 0xFF) == 0x65) {
+            last = (opcode >> 8) & 0xF;
+         } else {
+            return 0;
+         }
+         break;
+
+      default:
+         return 0;
+   }
+
+   return chip8->I + last > 0xFFF;
+}
+
+static void SaveRegisters(Registers * r, Chip8 * chip8)
+{
+   memcpy(r->V, chip8->V, 16);
+   r->I = chip8->I;
+   r->pc = chip8->pc;
+   r->sp = chip8->sp;
+   r->delay_timer = chip8->delay_timer;
+   r->sound_timer = chip8->sound_timer;
+}
+
+/*
+   Run w->keys from frame from to maxframes, starting from state,
+   counting edges into w->trace and taking snapshots on the way.
+   Returns FOUND_*, with w->end the last frame started
+*/
+static int Run(Worker * w, int from, Chip8 * state)
+{
+   Chip8 chip8 = *state;
+   Registers before, after;
+   unsigned int prev = 0, loc;
+   unsigned short tried = 0; /* Keys pressed since the CPU last changed */
+   int frame, i, err, still = 0;
+
+   SaveRegisters(&before, &chip8);
+
+   for (frame = from; frame < maxframes; frame++)
+   {
+      if (frame % SNAP_EVERY == 0 && frame > from) w->snaps[frame / SNAP_EVERY] = chip8;
+
+      for (i = 0; i < 16; i++)
+      {
+         chip8.key[i] = (w->keys[frame] >> i) & 1;
+      }
+      /* Only a key pressed alone counts, FX0A takes the lowest of several */
+      if ((w->keys[frame] & (w->keys[frame] - 1)) == 0) tried |= w->keys[frame];
+
+      for (i = 0; i < cycles; i++)
+      {
+         if (OutOfRange(&chip8))
+         {
+            w->end = frame;
+            w->pc = chip8.pc;
+            w->opcode = chip8.memory[chip8.pc & 0xFFF] << 8 | chip8.memory[(chip8.pc + 1) & 0xFFF];
+            w->I = chip8.I;
+            return FOUND_MEMORY;
+         }
+
+         err = EmulateCycleTable(&chip8);
+
+         /* Branch free, one increment per instruction */
+         loc = locations[chip8.pc & 0xFFF];
+         w->trace[loc ^ prev]++;
+         prev = loc >> 1;
+
+         if (err != 0)
+         {
+            w->end = frame;
+            w->pc = chip8.pc;
+            w->opcode = chip8.opcode;
+            if (err == ERR_OPCODE) return FOUND_OPCODE;
+            if (err == ERR_STACK_OVERFLOW) return FOUND_OVERFLOW;
+            if (err == ERR_STACK_UNDERFLOW) return FOUND_UNDERFLOW;
+            return FOUND_NONE; /* 00FD exit ends the run quietly */
+         }
+      }
+      DecrementTimers(&chip8);
+
+      SaveRegisters(&after, &chip8);
+      if (memcmp(&before, &after, sizeof(Registers)) == 0)
+      {
+         if (++still >= HANG_FRAMES && tried == keymask)
+         {
+            w->end = frame;
+            w->pc = chip8.pc;
+            w->opcode = chip8.memory[chip8.pc & 0xFFF] << 8 | chip8.memory[(chip8.pc + 1) & 0xFFF];
+            return w->opcode == (0x1000 | chip8.pc) ? FOUND_NONE : FOUND_HANG;
+         }
+      } else {
+         before = after;
+         still = 0;
+         tried = 0;
+      }
+   }
+
+   w->end = maxframes - 1;
+   return FOUND_NONE;
+}
+
+/* Merge the run's buckets into virgin, clearing the trace. Returns the number of new bits */
+static int NewCoverage(Worker * w)
+{
+   uint64_t *words = (uint64_t *) w->trace;
+   unsigned char bits, old;
+   int i, j, fresh = 0;
+
+   for (i = 0; i < MAP_SIZE / 8; i++)
+   {
+      if (words[i] == 0) continue;
+
+      for (j = i * 8; j < i * 8 + 8; j++)
+      {
+         bits = buckets[w->trace[j]];
+         if ((bits & ~__atomic_load_n(&virgin[j], __ATOMIC_RELAXED)) == 0) continue;
+
+         old = __atomic_fetch_or(&virgin[j], bits, __ATOMIC_RELAXED);
+         if (bits & ~old) fresh++;
+         if (old == 0) __atomic_add_fetch(&edges, 1, __ATOMIC_RELAXED);
+      }
+      words[i] = 0;
+   }
+
+   return fresh;
+}
+
+/*
+   Copy of the run as a corpus entry. Snapshots before the cut come
+   from its parent, the rest from frames this run got to
+*/
+static void AddEntry(Worker * w, Entry * parent, int cut)
+{
+   Entry *e;
+   int k, n, first = cut / SNAP_EVERY;
+
+   n = w->end / SNAP_EVERY + 1;
+
+   e = malloc(sizeof(Entry));
+   if (e == NULL) return;
+   e->keys = malloc(maxframes * sizeof(unsigned short));
+   e->snaps = malloc(n * sizeof(Chip8));
+   if (e->keys == NULL || e->snaps == NULL)
+   {
+      free(e->keys);
+      free(e->snaps);
+      free(e);
+      return;
+   }
+
+   memcpy(e->keys, w->keys, maxframes * sizeof(unsigned short));
+   for (k = 0; k < n; k++)
+   {
+      e->snaps[k] = (k <= first && parent != NULL) ? parent->snaps[k] : w->snaps[k];
+   }
+   e->nsnaps = n;
+
+   pthread_mutex_lock(&corpuslock);
+   if (ncorpus < MAX_CORPUS)
+   {
+      corpus[ncorpus] = e;
+      __atomic_store_n(&ncorpus, ncorpus + 1, __ATOMIC_RELEASE);
+      e = NULL;
+   }
+   pthread_mutex_unlock(&corpuslock);
+
+   if (e != NULL)
+   {
+      free(e->keys);
+      free(e->snaps);
+      free(e);
+   }
+}
+
+static unsigned short RandomMask(Worker * w)
+{
+   uint64_t r = Random64(&w->rng);
+
+   /* Mostly no key or one key, as a player would press them */
+   switch (r & 3)
+   {
+      case 0: return 0;
+      case 1:
+      case 2: return (1 << ((r >> 8) & 0xF)) & keymask;
+      default: return (r >> 16) & keymask;
+   }
+}
+
+/* Parent's keys with a few changes from a snapshot frame on. Returns that frame */
+static int Mutate(Worker * w, Entry * parent, int ncorpus)
+{
+   Entry *other;
+   int cut, n, i, at, len, end;
+   unsigned short mask;
+   uint64_t r;
+
+   memcpy(w->keys, parent->keys, maxframes * sizeof(unsigned short));
+   cut = (Random64(&w->rng) % parent->nsnaps) * SNAP_EVERY;
+
+   for (n = 1 + Random64(&w->rng) % 4; n > 0; n--)
+   {
+      r = Random64(&w->rng);
+      at = cut + r % (maxframes - cut);
+      len = 1 + (r >> 16) % SNAP_EVERY;
+      end = at + len < maxframes ? at + len : maxframes;
+      mask = RandomMask(w);
+
+      switch ((r >> 32) % 6)
+      {
+         case 0: /* Hold a new mask */
+            for (i = at; i < end; i++) w->keys[i] = mask;
+            break;
+
+         case 1: /* Toggle one key */
+            mask = (1 << ((r >> 40) & 0xF)) & keymask;
+            for (i = at; i < end; i++) w->keys[i] ^= mask;
+            break;
+
+         case 2: /* Let go */
+            for (i = at; i < end; i++) w->keys[i] = 0;
+            break;
+
+         case 3: /* Splice in another input at the same frames */
+            other = corpus[(r >> 40) % ncorpus];
+            memcpy(&w->keys[at], &other->keys[at], (end - at) * sizeof(unsigned short));
+            break;
+
+         case 4: /* Walk the keypad, each key alone for two frames */
+            end = at + 32 < maxframes ? at + 32 : maxframes;
+            for (i = at; i < end; i++) w->keys[i] = (1 << (((i - at) >> 1) & 0xF)) & keymask;
+            break;
+
+         default: /* Tap, one frame at a time */
+            for (i = at; i < end; i++) w->keys[i] = (i & 1) ? mask : 0;
+            break;
+      }
+   }
+
+   return cut;
+}
+
+static void PrintScript(FILE * file, unsigned short * keys, int end)
+{
+   unsigned short held = 0;
+   int frame;
+
+   for (frame = 0; frame <= end && frame < maxframes; frame++)
+   {
+      if (keys[frame] != held)
+      {
+         held = keys[frame];
+         fprintf(file, "%d %x\n", frame, held);
+      }
+   }
+}
+
+static void Report(Worker * w, int kind)
+{
+   char path[4096];
+   FILE *file;
+   int i;
+
+   pthread_mutex_lock(&reportlock);
+
+   for (i = 0; i < nfindings; i++)
+   {
+      if (findings[i].kind == kind && findings[i].pc == w->pc) break;
+   }
+
+   if (i == nfindings && nfindings < MAX_FINDINGS)
+   {
+      findings[nfindings].kind = kind;
+      findings[nfindings].pc = w->pc;
+      nfindings++;
+
+      if (found[kind]++ < MAX_REPORTS)
+      {
+         printf("# %s at frame %d: pc %x opcode %04x", foundnames[kind], w->end + 1, w->pc, w->opcode);
+         if (kind == FOUND_MEMORY) printf(" I %x", w->I);
+         printf(", after %lu runs\n", w->execs);
+         PrintScript(stdout, w->keys, w->end);
+         fflush(stdout);
+      }
+
+      if (savedir != NULL)
+      {
+         snprintf(path, sizeof(path), "%s/%s-%03x.keys", savedir, foundnames[kind], w->pc);
+         if ((file = fopen(path, "w")) != NULL)
+         {
+            fprintf(file, "# %s at frame %d: pc %x opcode %04x\n", foundnames[kind], w->end + 1, w->pc, w->opcode);
+            PrintScript(file, w->keys, w->end);
+            fclose(file);
+         }
+      }
+   }
+
+   pthread_mutex_unlock(&reportlock);
+}
+
+static void * WorkerThread(void * arg)
+{
+   Worker *w = arg;
+   Entry *parent;
+   int n, cut, kind;
+
+   while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+   {
+      n = __atomic_load_n(&ncorpus, __ATOMIC_ACQUIRE);
+      parent = corpus[Random64(&w->rng) % n];
+      cut = Mutate(w, parent, n);
+
+      kind = Run(w, cut, &parent->snaps[cut / SNAP_EVERY]);
+      w->execs++;
+
+      if (kind != FOUND_NONE) Report(w, kind);
+      if (NewCoverage(w) > 0) AddEntry(w, parent, cut);
+   }
+
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   pthread_t *threads;
+   Worker *workers;
+   struct timespec t0, t1;
+   unsigned long execs = 0;
+   uint64_t seed = time(NULL);
+   uint64_t rng;
+   const char *rom = NULL;
+   const char *packpath = NULL;
+   double elapsed;
+   int seconds = 10;
+   int nthreads = 0;
+   int profile = -1;
+   int i, kind, total = 0;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--seconds") == 0 && i+1 < argc)
+      {
+         seconds = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--jobs") == 0 && i+1 < argc) {
+         nthreads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+         seed = strtoull(argv[++i], NULL, 0);
+      } else if (strcmp(argv[i], "--frames") == 0 && i+1 < argc) {
+         maxframes = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--cycles") == 0 && i+1 < argc) {
+         cycles = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc) {
+         if ((profile = ProfileByName(argv[++i])) < 0)
+         {
+            printf("Unknown profile %s\n", argv[i]);
+            return 4;
+         }
+      } else if (strcmp(argv[i], "--keys") == 0 && i+1 < argc) {
+         keymask = strtoul(argv[++i], NULL, 16);
+      } else if (strcmp(argv[i], "--save") == 0 && i+1 < argc) {
+         savedir = argv[++i];
+      } else if (strcmp(argv[i], "--pack") == 0 && i+1 < argc) {
+         packpath = argv[++i];
+      } else if (rom == NULL) {
+         rom = argv[i];
+      } else {
+         rom = NULL;
+         break;
+      }
+   }
+
+   if (rom == NULL || maxframes <= 0)
+   {
+      printf("Usage: keyfuzz [--seconds N] [--jobs N] [--seed N] [--frames N] [--cycles N]\n");
+      printf("               [--profile name] [--pack file] [--keys mask] [--save dir] rom.ch8\n");
+      return 4;
+   }
+
+   InitCPU(&boot);
+   if (LoadROM(&boot, packpath, rom, &profile, &cycles) != 0)
+   {
+      printf("Cannot load %s\n", rom);
+      return 2;
+   }
+   if (cycles <= 0) cycles = CYCLES_PER_FRAME;
+   if (profile < 0) profile = LookupProfile(QUIRKS_DB, ProgramHash(&boot));
+   if (profile >= 0) boot.profile = profile;
+
+   rng = seed * 0x9E3779B97F4A7C15ULL | 1;
+   for (i = 0; i < 4096; i++)
+   {
+      locations[i] = Random64(&rng) & (MAP_SIZE - 1);
+   }
+   for (i = 1; i < 256; i++)
+   {
+      buckets[i] = i < 4 ? 1 << (i - 1) : i < 8 ? 8 : i < 16 ? 16 : i < 32 ? 32 : i < 128 ? 64 : 128;
+   }
+   maxsnaps = (maxframes - 1) / SNAP_EVERY + 1;
+
+   if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads <= 0) nthreads = 1;
+
+   threads = malloc(nthreads * sizeof(pthread_t));
+   workers = calloc(nthreads, sizeof(Worker));
+   if (threads == NULL || workers == NULL)
+   {
+      printf("Out of memory\n");
+      return 1;
+   }
+   for (i = 0; i < nthreads; i++)
+   {
+      workers[i].rng = (seed + i + 1) * 0x9E3779B97F4A7C15ULL | 1;
+      workers[i].keys = calloc(maxframes, sizeof(unsigned short));
+      workers[i].snaps = malloc(maxsnaps * sizeof(Chip8));
+      if (workers[i].keys == NULL || workers[i].snaps == NULL)
+      {
+         printf("Out of memory\n");
+         return 1;
+      }
+   }
+
+   /* The first entry holds no keys at all */
+   workers[0].snaps[0] = boot;
+   kind = Run(&workers[0], 0, &boot);
+   if (kind != FOUND_NONE) Report(&workers[0], kind);
+   NewCoverage(&workers[0]);
+   AddEntry(&workers[0], NULL, 0);
+   if (ncorpus == 0)
+   {
+      printf("Out of memory\n");
+      return 1;
+   }
+
+   printf("# Fuzzing keys for %s, profile %s, %d frames, %d threads for %d seconds, seed %" PRIu64 "\n",
+      rom, quirk_profiles[boot.profile].name, maxframes, nthreads, seconds, seed);
+   fflush(stdout);
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for (i = 0; i < nthreads; i++)
+   {
+      pthread_create(&threads[i], NULL, WorkerThread, &workers[i]);
+   }
+
+   sleep(seconds);
+   __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+   for (i = 0; i < nthreads; i++)
+   {
+      pthread_join(threads[i], NULL);
+      execs += workers[i].execs;
+      free(workers[i].keys);
+      free(workers[i].snaps);
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+   for (kind = 0; kind < NFOUND; kind++)
+   {
+      total += found[kind];
+   }
+
+   printf("# %lu runs, %.0f runs/hour per thread, %d inputs in the corpus, %lu edges\n",
+      execs, execs / elapsed * 3600 / nthreads, ncorpus, edges);
+   printf("# %lu bad opcodes, %lu stack overflows, %lu stack underflows, %lu out of range accesses, %lu hangs\n",
+      found[FOUND_OPCODE], found[FOUND_OVERFLOW], found[FOUND_UNDERFLOW], found[FOUND_MEMORY], found[FOUND_HANG]);
+
+   for (i = 0; i < ncorpus; i++)
+   {
+      free(corpus[i]->keys);
+      free(corpus[i]->snaps);
+      free(corpus[i]);
+   }
+   free(threads);
+   free(workers);
+
+   return total ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+/*
+   * @file   mkpack.c
+   * @brief  Builds a ROM corpus pack, see pack.h
+   *
+   * Each ROM is hashed as the emulator would load it and its
+   * profile is looked up in the quirks database. --profile and
+   * --cycles apply to the ROMs after them on the command line.
+   *
+   * Usage: mkpack [--quirks-db file] out.pack [--profile name] [--cycles N] rom.ch8 ...
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "pack.h"
+
+typedef struct {
+   PackEntry entry;
+   unsigned char image[ROM_MAX];
+} Packed;
+
+static int ByHash(const void * a, const void * b)
+{
+   uint64_t x = ((const Packed *) a)->entry.hash;
+   uint64_t y = ((const Packed *) b)->entry.hash;
+
+   return x < y ? -1 : x > y;
+}
+
+/* File name without directory or extension */
+static int BaseName(char * out, const char * path)
+{
+   const char *base = strrchr(path, '/');
+   const char *dot;
+   size_t len;
+
+   base = base ? base + 1 : path;
+   dot = strrchr(base, '.');
+   len = dot != NULL ? (size_t) (dot - base) : strlen(base);
+   if (len == 0 || len >= PACK_NAME) return 1;
+
+   memcpy(out, base, len);
+   out[len] = 0;
+
+   return 0;
+}
+
+static int ReadROM(Packed * p, const char * path)
+{
+   FILE *file;
+   size_t n;
+
+   if ((file = fopen(path, "rb")) == NULL) return 1;
+   n = fread(p->image, 1, sizeof(p->image), file);
+   if (fgetc(file) != EOF || n == 0)
+   {
+      fclose(file);
+      return 1;
+   }
+   fclose(file);
+   p->entry.size = n;
+
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   static Chip8 chip8;
+   PackHeader header;
+   struct stat st;
+   Packed *roms;
+   FILE *out;
+   const char *path = NULL;
+   const char *quirksdb = QUIRKS_DB;
+   uint64_t offset;
+   int profile = -1;
+   int cycles = 0;
+   int count = 0;
+   int i, k, err;
+
+   roms = calloc(argc, sizeof(Packed));
+   if (roms == NULL) return 1;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--quirks-db") == 0 && i+1 < argc)
+      {
+         quirksdb = argv[++i];
+      } else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc) {
+         if ((profile = ProfileByName(argv[++i])) < 0)
+         {
+            printf("Unknown profile %s\n", argv[i]);
+            return 4;
+         }
+      } else if (strcmp(argv[i], "--cycles") == 0 && i+1 < argc) {
+         cycles = atoi(argv[++i]);
+         if (cycles < 0) cycles = 0;
+      } else if (path == NULL) {
+         path = argv[i];
+      } else {
+         Packed *p = &roms[count];
+
+         if (BaseName(p->entry.name, argv[i]) != 0)
+         {
+            printf("Bad ROM name %s, 1 to %d characters\n", argv[i], PACK_NAME - 1);
+            return 4;
+         }
+         for (k = 0; k < count; k++)
+         {
+            if (strcmp(roms[k].entry.name, p->entry.name) == 0)
+            {
+               printf("Two ROMs named %s\n", p->entry.name);
+               return 4;
+            }
+         }
+         if (ReadROM(p, argv[i]) != 0)
+         {
+            printf("Cannot load %s, or larger than %d bytes\n", argv[i], ROM_MAX);
+            return 2;
+         }
+
+         InitCPU(&chip8);
+         memcpy(&chip8.memory[ROM_START], p->image, p->entry.size);
+         p->entry.hash = ProgramHash(&chip8);
+         p->entry.profile = profile >= 0 ? profile : LookupProfile(quirksdb, p->entry.hash);
+         p->entry.cycles = cycles;
+         count++;
+      }
+   }
+
+   if (path == NULL || count == 0)
+   {
+      printf("Usage: mkpack [--quirks-db file] out.pack [--profile name] [--cycles N] rom.ch8 ...\n");
+      return 4;
+   }
+
+   /* Hash lookups binary search the index */
+   qsort(roms, count, sizeof(Packed), ByHash);
+
+   offset = sizeof(PackHeader);
+   for (i = 0; i < count; i++)
+   {
+      roms[i].entry.offset = offset;
+      offset += roms[i].entry.size;
+   }
+
+   memset(&header, 0, sizeof(header));
+   header.magic = PACK_MAGIC;
+   header.version = PACK_VERSION;
+   header.order = PACK_ORDER;
+   header.count = count;
+   header.index = (offset + 7) & ~(uint64_t) 7;
+
+   if ((out = fopen(path, "wb")) == NULL)
+   {
+      printf("Cannot write %s\n", path);
+      return 2;
+   }
+
+   /* A short write would leave a truncated pack, so remove it, unless it's a device */
+   err = fwrite(&header, sizeof(header), 1, out) != 1;
+   for (i = 0; i < count && !err; i++)
+   {
+      err = fwrite(roms[i].image, 1, roms[i].entry.size, out) != roms[i].entry.size;
+   }
+   for (; offset < header.index && !err; offset++)
+   {
+      err = fputc(0, out) == EOF;
+   }
+   for (i = 0; i < count && !err; i++)
+   {
+      err = fwrite(&roms[i].entry, sizeof(PackEntry), 1, out) != 1;
+   }
+   if (ferror(out)) err = 1;
+
+   if (fclose(out) != 0 || err)
+   {
+      printf("Cannot write %s\n", path);
+      if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) remove(path);
+      return 2;
+   }
+
+   for (i = 0; i < count; i++)
+   {
+      printf("%016" PRIx64 " %5u %-8s %s\n", roms[i].entry.hash, roms[i].entry.size,
+         roms[i].entry.profile >= 0 ? quirk_profiles[roms[i].entry.profile].name : "-", roms[i].entry.name);
+   }
+   printf("%d ROMs in %s\n", count, path);
+
+   free(roms);
+
+   return 0;
+}
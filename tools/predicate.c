@@ -0,0 +1,119 @@
+/*
+   * @file   predicate.c
+   * @brief  Conditions on machine state given on the command
+   *         line, such as "mem[0x3f0] >= 5" or "V3 == 2"
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "predicate.h"
+
+/* Parses an operand off the front of *text and advances it */
+int ParseOperand(Operand * operand, const char ** text)
+{
+   static const char hex[] = "0123456789ABCDEFabcdef";
+   const char *s = *text;
+   char *end;
+
+   while (*s == ' ') s++;
+
+   if (strncmp(s, "mem[", 4) == 0)
+   {
+      operand->what = OPERAND_MEM;
+      operand->index = strtol(s + 4, &end, 0) & 0xFFF;
+      if (*end != ']') return 1;
+      s = end + 1;
+   } else if (s[0] == 'V' && s[1] != '\0' && strchr(hex, s[1]) != NULL) {
+      operand->what = OPERAND_V;
+      operand->index = (strchr(hex, s[1]) - hex) & 0xF;
+      s += 2;
+   } else if (strncmp(s, "pc", 2) == 0) {
+      operand->what = OPERAND_PC;
+      s += 2;
+   } else if (strncmp(s, "sp", 2) == 0) {
+      operand->what = OPERAND_SP;
+      s += 2;
+   } else if (strncmp(s, "dt", 2) == 0) {
+      operand->what = OPERAND_DT;
+      s += 2;
+   } else if (strncmp(s, "st", 2) == 0) {
+      operand->what = OPERAND_ST;
+      s += 2;
+   } else if (s[0] == 'I') {
+      operand->what = OPERAND_I;
+      s += 1;
+   } else {
+      return 1;
+   }
+
+   *text = s;
+
+   return 0;
+}
+
+/* Returns non-zero if text isn't "operand op number" */
+int ParsePredicate(Predicate * p, const char * text)
+{
+   static const char *ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+   static const int codes[] = { OP_EQ, OP_NE, OP_LE, OP_GE, OP_LT, OP_GT };
+   const char *s = text;
+   char *end;
+   int i;
+
+   snprintf(p->text, sizeof(p->text), "%s", text);
+   if (ParseOperand(&p->lhs, &s) != 0) return 1;
+   while (*s == ' ') s++;
+
+   for (i = 0; i < 6; i++)
+   {
+      if (strncmp(s, ops[i], strlen(ops[i])) == 0) break;
+   }
+   if (i == 6) return 1;
+   p->op = codes[i];
+   s += strlen(ops[i]);
+
+   p->value = strtol(s, &end, 0);
+   if (end == s) return 1;
+   while (*end == ' ') end++;
+
+   return *end != '\0';
+}
+
+long OperandValue(Chip8 * chip8, Operand * operand)
+{
+   switch(operand->what)
+   {
+      case OPERAND_MEM: return chip8->memory[operand->index];
+      case OPERAND_V: return chip8->V[operand->index];
+      case OPERAND_I: return chip8->I;
+      case OPERAND_PC: return chip8->pc;
+      case OPERAND_SP: return chip8->sp;
+      case OPERAND_DT: return chip8->delay_timer;
+      default: return chip8->sound_timer;
+   }
+}
+
+/* Do all n predicates hold? True for n == 0 */
+int AllHold(Chip8 * chip8, Predicate * p, int n)
+{
+   long v;
+   int i, ok;
+
+   for (i = 0; i < n; i++)
+   {
+      v = OperandValue(chip8, &p[i].lhs);
+      switch(p[i].op)
+      {
+         case OP_EQ: ok = v == p[i].value; break;
+         case OP_NE: ok = v != p[i].value; break;
+         case OP_LT: ok = v < p[i].value; break;
+         case OP_LE: ok = v <= p[i].value; break;
+         case OP_GT: ok = v > p[i].value; break;
+         default: ok = v >= p[i].value; break;
+      }
+      if (!ok) return 0;
+   }
+
+   return 1;
+}
@@ -0,0 +1,33 @@
+/*
+   * @file   predicate.h
+   * @brief  Conditions on machine state given on the command line
+   *
+   * An operand is mem[ADDR], V0 .. VF, I, pc, sp, dt or st. A
+   * predicate is an operand, one of == != < <= > >=, and a number.
+*/
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include "cpu.h"
+
+enum { OPERAND_MEM, OPERAND_V, OPERAND_I, OPERAND_PC, OPERAND_SP, OPERAND_DT, OPERAND_ST };
+enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+typedef struct {
+   int what; /* OPERAND_* */
+   int index; /* Address or register number */
+} Operand;
+
+typedef struct {
+   Operand lhs;
+   int op; /* OP_* */
+   long value;
+   char text[64]; /* As given, for messages */
+} Predicate;
+
+int ParseOperand(Operand * operand, const char ** text);
+int ParsePredicate(Predicate * p, const char * text);
+long OperandValue(Chip8 * chip8, Operand * operand);
+int AllHold(Chip8 * chip8, Predicate * p, int n);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+   * @file   vecenv.c
+   * @brief  Vector environment server over POSIX shared memory
+   *
+   * Runs N headless copies of one ROM for agent training. Each
+   * request steps every env one frame with its own keypad mask,
+   * then the rewards and done flags are written straight into the
+   * shared memory object the consumer has mapped, and each screen
+   * is copied there once (1 KB per env). The layout is in vecenv.h.
+   * Requests and replies are two process shared semaphores, so
+   * nothing is serialised per step.
+   *
+   * The reward is the change in score over a step. The score is
+   * the sum of the --score fields, each LEN bytes of decimal
+   * digits as FX33 writes them (LEN 1 is a plain byte). An episode
+   * ends on any --done predicate, on --max-frames, or when the ROM
+   * crashes or exits.
+   *
+   * Usage: vecenv [--envs N] [--name /shm-name] [--jobs N] [--cycles N]
+   *               [--profile name] [--pack file] [--score ADDR[:LEN]] ... [--done expr] ...
+   *               [--max-frames N] rom.ch8
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "engine.h"
+#include "pack.h"
+#include "predicate.h"
+#include "vecenv.h"
+
+#define VECENV_NAME "/chip8-vecenv"
+#define MAX_FIELDS 16
+#define ALIGN(n) (((n) + 63) & ~(uint64_t) 63) /* Arrays start on their own cache line */
+
+typedef struct {
+   int addr;
+   int len; /* Decimal digits, one per byte */
+} ScoreField;
+
+typedef struct {
+   int first, last; /* Envs [first, last) */
+} Share;
+
+static VecEnvHeader *header;
+static Chip8 boot;
+static Chip8 *envs;
+static long *scores; /* Score at the end of the last step, per env */
+static int cycles;
+static ScoreField fields[MAX_FIELDS];
+static int nfields;
+static Predicate dones[MAX_FIELDS];
+static int ndones;
+static unsigned long maxframes;
+static pthread_barrier_t start, finish;
+static int quit;
+static volatile sig_atomic_t interrupted;
+
+static void Interrupt(int sig)
+{
+   (void) sig;
+   interrupted = 1;
+}
+
+static long Score(Chip8 * chip8)
+{
+   long total = 0, value;
+   int i, k;
+
+   for (i = 0; i < nfields; i++)
+   {
+      value = 0;
+      for (k = 0; k < fields[i].len; k++)
+      {
+         value = value * 10 + chip8->memory[(fields[i].addr + k) & 0xFFF];
+      }
+      total += value;
+   }
+
+   return total;
+}
+
+static void StepEnv(int i, uint32_t command)
+{
+   char *base = (char *) header;
+   uint16_t *actions = (uint16_t *) (base + header->actions);
+   uint8_t *hires = (uint8_t *) (base + header->hires);
+   float *rewards = (float *) (base + header->rewards);
+   uint8_t *done = (uint8_t *) (base + header->dones);
+   uint8_t *errors = (uint8_t *) (base + header->errors);
+   uint32_t *frames = (uint32_t *) (base + header->frames);
+   uint64_t (*screens)[64][2] = (uint64_t (*)[64][2]) (base + header->screens);
+   Chip8 *chip8 = &envs[i];
+   long score;
+   int k, err, d;
+
+   if (command == VECENV_RESET || done[i])
+   {
+      *chip8 = boot;
+      scores[i] = Score(chip8);
+      frames[i] = 0;
+      done[i] = 0;
+      errors[i] = 0;
+      rewards[i] = 0;
+   }
+
+   if (command == VECENV_STEP)
+   {
+      for (k = 0; k < 16; k++)
+      {
+         chip8->key[k] = (actions[i] >> k) & 1;
+      }
+
+      err = EmulateFrameTable(chip8, cycles);
+      frames[i]++;
+
+      score = Score(chip8);
+      rewards[i] = score - scores[i];
+      scores[i] = score;
+
+      d = err != 0 || (maxframes > 0 && frames[i] >= maxframes);
+      for (k = 0; k < ndones && !d; k++)
+      {
+         d = AllHold(chip8, &dones[k], 1);
+      }
+      errors[i] = err;
+      done[i] = d;
+   }
+
+   memcpy(screens[i], chip8->gfx, sizeof(chip8->gfx));
+   hires[i] = chip8->hires;
+}
+
+static void RunShare(Share * share)
+{
+   uint32_t command = header->command;
+   int i;
+
+   for (i = share->first; i < share->last; i++)
+   {
+      StepEnv(i, command);
+   }
+}
+
+static void * Worker(void * arg)
+{
+   Share *share = arg;
+
+   for (;;)
+   {
+      pthread_barrier_wait(&start);
+      if (quit) break;
+      RunShare(share);
+      pthread_barrier_wait(&finish);
+   }
+
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   struct sigaction action;
+   VecEnvHeader layout;
+   pthread_t *threads;
+   Share *shares;
+   const char *rom = NULL;
+   const char *packpath = NULL;
+   const char *name = VECENV_NAME;
+   char *end;
+   uint64_t offset;
+   int nenvs = 16;
+   int nthreads = 0;
+   int profile = -1;
+   int fd, i;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--envs") == 0 && i+1 < argc)
+      {
+         nenvs = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--name") == 0 && i+1 < argc) {
+         name = argv[++i];
+      } else if (strcmp(argv[i], "--jobs") == 0 && i+1 < argc) {
+         nthreads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--cycles") == 0 && i+1 < argc) {
+         cycles = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc) {
+         if ((profile = ProfileByName(argv[++i])) < 0)
+         {
+            printf("Unknown profile %s\n", argv[i]);
+            return 4;
+         }
+      } else if (strcmp(argv[i], "--score") == 0 && i+1 < argc && nfields < MAX_FIELDS) {
+         fields[nfields].addr = strtol(argv[++i], &end, 0) & 0xFFF;
+         fields[nfields].len = *end == ':' ? atoi(end + 1) : 1;
+         if (fields[nfields].len < 1 || fields[nfields].len > 9)
+         {
+            printf("Bad score field %s\n", argv[i]);
+            return 4;
+         }
+         nfields++;
+      } else if (strcmp(argv[i], "--done") == 0 && i+1 < argc && ndones < MAX_FIELDS) {
+         if (ParsePredicate(&dones[ndones], argv[++i]) != 0)
+         {
+            printf("Bad done condition %s\n", argv[i]);
+            return 4;
+         }
+         ndones++;
+      } else if (strcmp(argv[i], "--max-frames") == 0 && i+1 < argc) {
+         maxframes = strtoul(argv[++i], NULL, 0);
+      } else if (strcmp(argv[i], "--pack") == 0 && i+1 < argc) {
+         packpath = argv[++i];
+      } else if (rom == NULL) {
+         rom = argv[i];
+      } else {
+         rom = NULL;
+         break;
+      }
+   }
+
+   if (rom == NULL || nenvs <= 0)
+   {
+      printf("Usage: vecenv [--envs N] [--name /shm-name] [--jobs N] [--cycles N]\n");
+      printf("              [--profile name] [--pack file] [--score ADDR[:LEN]] ... [--done expr] ...\n");
+      printf("              [--max-frames N] rom.ch8\n");
+      return 4;
+   }
+
+   InitCPU(&boot);
+   if (LoadROM(&boot, packpath, rom, &profile, &cycles) != 0)
+   {
+      printf("Cannot load %s\n", rom);
+      return 2;
+   }
+   if (cycles <= 0) cycles = CYCLES_PER_FRAME;
+   if (profile < 0) profile = LookupProfile(QUIRKS_DB, ProgramHash(&boot));
+   if (profile >= 0) boot.profile = profile;
+
+   envs = malloc(nenvs * sizeof(Chip8));
+   scores = calloc(nenvs, sizeof(long));
+   if (envs == NULL || scores == NULL)
+   {
+      printf("Out of memory\n");
+      return 1;
+   }
+
+   /* Lay out the arrays after the header */
+   offset = ALIGN(sizeof(VecEnvHeader));
+   memset(&layout, 0, sizeof(layout));
+   layout.actions = offset;
+   offset = ALIGN(offset + nenvs * sizeof(uint16_t));
+   layout.screens = offset;
+   offset = ALIGN(offset + nenvs * sizeof(boot.gfx));
+   layout.hires = offset;
+   offset = ALIGN(offset + nenvs);
+   layout.rewards = offset;
+   offset = ALIGN(offset + nenvs * sizeof(float));
+   layout.dones = offset;
+   offset = ALIGN(offset + nenvs);
+   layout.errors = offset;
+   offset = ALIGN(offset + nenvs);
+   layout.frames = offset;
+   offset = ALIGN(offset + nenvs * sizeof(uint32_t));
+   layout.size = offset;
+
+   if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+   {
+      printf("Cannot create shared memory %s: %s\n", name, strerror(errno));
+      return 2;
+   }
+   if (ftruncate(fd, layout.size) != 0 ||
+      (header = mmap(NULL, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+   {
+      printf("Cannot map shared memory %s: %s\n", name, strerror(errno));
+      close(fd);
+      shm_unlink(name);
+      return 2;
+   }
+   close(fd);
+
+   /* ftruncate zeroed it. Fill in the header, then start every env from boot */
+   header->magic = VECENV_MAGIC;
+   header->version = VECENV_VERSION;
+   header->nenvs = nenvs;
+   header->actions = layout.actions;
+   header->screens = layout.screens;
+   header->hires = layout.hires;
+   header->rewards = layout.rewards;
+   header->dones = layout.dones;
+   header->errors = layout.errors;
+   header->frames = layout.frames;
+   header->size = layout.size;
+   sem_init(&header->request, 1, 0);
+   sem_init(&header->reply, 1, 0);
+   for (i = 0; i < nenvs; i++)
+   {
+      StepEnv(i, VECENV_RESET);
+   }
+
+   /* Ctrl-C interrupts sem_wait, so the object still gets unlinked */
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = Interrupt;
+   sigaction(SIGINT, &action, NULL);
+   sigaction(SIGTERM, &action, NULL);
+
+   if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads <= 0) nthreads = 1;
+   if (nthreads > nenvs) nthreads = nenvs;
+
+   threads = malloc(nthreads * sizeof(pthread_t));
+   shares = malloc(nthreads * sizeof(Share));
+   pthread_barrier_init(&start, NULL, nthreads);
+   pthread_barrier_init(&finish, NULL, nthreads);
+
+   /* This thread takes share 0 itself */
+   for (i = 0; i < nthreads; i++)
+   {
+      shares[i].first = (long) nenvs * i / nthreads;
+      shares[i].last = (long) nenvs * (i + 1) / nthreads;
+      if (i > 0) pthread_create(&threads[i], NULL, Worker, &shares[i]);
+   }
+
+   printf("Serving %d envs of %s in %s (%lu bytes), profile %s, %d threads\n",
+      nenvs, rom, name, (unsigned long) layout.size, quirk_profiles[boot.profile].name, nthreads);
+   fflush(stdout);
+   __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+
+   while (!interrupted)
+   {
+      if (sem_wait(&header->request) != 0) continue;
+      if (header->command == VECENV_QUIT) break;
+
+      pthread_barrier_wait(&start);
+      RunShare(&shares[0]);
+      pthread_barrier_wait(&finish);
+
+      header->steps++;
+      sem_post(&header->reply);
+   }
+
+   quit = 1;
+   pthread_barrier_wait(&start);
+   for (i = 1; i < nthreads; i++)
+   {
+      pthread_join(threads[i], NULL);
+   }
+
+   printf("Served %lu requests\n", (unsigned long) header->steps);
+
+   header->ready = 0;
+   sem_destroy(&header->request);
+   sem_destroy(&header->reply);
+   munmap(header, layout.size);
+   shm_unlink(name);
+
+   pthread_barrier_destroy(&start);
+   pthread_barrier_destroy(&finish);
+   free(threads);
+   free(shares);
+   free(envs);
+   free(scores);
+
+   return 0;
+}
@@ -0,0 +1,52 @@
+/*
+   * @file   vecenv.h
+   * @brief  Shared memory layout of the vector environment server
+   *
+   * tools/vecenv runs N headless emulators and owns one POSIX
+   * shared memory object. A consumer maps the same object and
+   * drives it with no serialisation. The server copies each
+   * screen in once per step, and the consumer reads it in place:
+   *
+   *   1. wait until header->ready is 1
+   *   2. write one keypad mask per env into the actions array
+   *   3. set header->command, sem_post(&header->request)
+   *   4. sem_wait(&header->reply), then read the result arrays
+   *
+   * Arrays sit at the byte offsets in the header, one entry per
+   * env. An env that is done is reset from boot at the start of
+   * its next step, so its terminal frame stays readable until then.
+*/
+#ifndef VECENV_H
+#define VECENV_H
+
+#include <stdint.h>
+#include <semaphore.h>
+
+#define VECENV_MAGIC 0x45563843 /* "C8VE" little endian */
+#define VECENV_VERSION 1
+
+/* header->command */
+#define VECENV_STEP 0 /* Every env runs one frame with its action */
+#define VECENV_RESET 1 /* Every env goes back to boot. Actions are ignored */
+#define VECENV_QUIT 2 /* Server unmaps, unlinks and exits */
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t nenvs;
+   uint32_t ready; /* Set once the server is waiting for requests */
+   sem_t request; /* Posted by the consumer */
+   sem_t reply; /* Posted by the server when the results are written */
+   uint32_t command; /* VECENV_* */
+   uint64_t steps; /* Requests served */
+   uint64_t actions; /* uint16_t[nenvs], keypad mask, bit N is key N */
+   uint64_t screens; /* uint64_t[nenvs][64][2], packed like Chip8.gfx */
+   uint64_t hires; /* uint8_t[nenvs], 1 if the screen is 128x64, else the top left 64x32 is used */
+   uint64_t rewards; /* float[nenvs], change in score over the step */
+   uint64_t dones; /* uint8_t[nenvs], 1 if the episode ended on this step */
+   uint64_t errors; /* uint8_t[nenvs], ERR_* code if it ended on an error, else 0 */
+   uint64_t frames; /* uint32_t[nenvs], frames into the current episode */
+   uint64_t size; /* Bytes in the whole object */
+} VecEnvHeader;
+
+#endif